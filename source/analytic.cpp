@@ -0,0 +1,281 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+#include "analytic.h"
+#include "binomial.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+// Compute the moments of every stage
+void Analytic::Compute(const Plan &plan, float n, float eps, bool demographic)
+{
+    Demographic=demographic;
+    if(demographic) n=std::round(n);
+    int S=plan.readStages();
+    tables.resize(plan.readCastings());
+    raw.resize(plan.readCastings());
+    exclusive.resize(plan.readCastings());
+    for(int t=0;t<plan.readCastings();++t) {
+        PlanCasting &c=tables[t];
+        c=plan.readCasting(t);
+        raw[t]=c.cells;
+        for(auto &&f: c.cells) if(!(f>0.0)) f=eps;
+        // Rows that split whole individuals among their following stages, scaled back to 1
+        // if quasi-zeros take them above, as Binomial::Split does
+        exclusive[t].assign(c.rows,0);
+        if(!demographic) continue;
+        for(int r=0;r<c.rows;++r) {
+            float *row=&c.cells[r*c.cols];
+            exclusive[t][r]=Binomial::Exclusive(Binomial::Sum(&raw[t][r*c.cols],1,c.cols));
+            double mass=0.0;
+            for(int k=0;k<c.cols;++k) mass+=row[k];
+            if(exclusive[t][r]&&mass>1.0) for(int k=0;k<c.cols;++k) row[k]=float(row[k]/mass);
+        }
+    }
+    parent.assign(S,-1);
+    depth.assign(S,0);
+    column.assign(S,-1);
+    factor.assign(S,1.0);
+    mean.assign(S,0.0);
+    second.assign(S,0.0);
+    casting.assign(S,-1);
+
+    // Preorder: the parent of every stage is done before it
+    for(int i=0;i<S;++i) {
+        const PlanNode &nd=plan.readNode(i);
+        parent[i]=nd.parent;
+        casting[i]=nd.casting;
+        if(nd.parent<0) {
+            mean[i]=n;
+            second[i]=double(n)*n;
+        } else depth[i]=depth[nd.parent]+1;
+
+        // Moments of the following stages
+        for(int c=0;c<nd.count;++c) {
+            int k=plan.readKid(nd.first+c);
+            double m1=1.0, m2=1.0, var=0.0;
+            if(nd.kind==StageKind::Caster) {
+                const PlanCasting &t=tables[nd.casting];
+                m1=m2=0.0;
+                for(int r=0;r<t.rows;++r) {
+                    double f=t.cells[r*t.cols+c], pr=t.readProbability(r);
+                    m1+=f*pr;
+                    m2+=f*f*pr;
+                    // Variance of the individuals one individual leaves
+                    double frac=f-std::floor(f);
+                    var+=frac*(1.0-frac)*pr;
+                }
+                column[k]=c;
+            }
+            factor[k]=m1;
+            mean[k]=mean[i]*m1;
+            second[k]=second[i]*m2+(demographic?mean[i]*var:0.0);
+        }
+    }
+
+    report.resize(plan.readReported());
+    for(int s=0;s<plan.readReported();++s) report[s]=plan.readReportedStage(s);
+}
+
+// E[X_a X_b] of stages a and b
+double Analytic::Cross(int a, int b) const
+{
+    if(a==b) return second[a];
+
+    // Walk up to the same depth: if one stage leads to the other, the factors
+    // in between are independent of it
+    double fa=1.0, fb=1.0;
+    while(depth[a]>depth[b]) {fa*=factor[a]; a=parent[a];}
+    while(depth[b]>depth[a]) {fb*=factor[b]; b=parent[b];}
+    if(a==b) return second[a]*fa*fb;
+
+    // Walk up to the caster where the paths split, which draws the same row for both
+    while(parent[a]!=parent[b]) {
+        fa*=factor[a];
+        fb*=factor[b];
+        a=parent[a];
+        b=parent[b];
+    }
+    int p=parent[a];
+    const PlanCasting &t=tables[casting[p]];
+    double cross=0.0, shared=0.0;
+    for(int r=0;r<t.rows;++r) {
+        const float *row=&t.cells[r*t.cols];
+        double f=double(row[column[a]])*row[column[b]]*t.readProbability(r);
+        cross+=f;
+        // Multinomial split: an individual goes to one of them at most
+        if(exclusive[casting[p]][r]) shared+=f;
+    }
+    return (second[p]*cross-mean[p]*shared)*fa*fb;
+}
+
+// Covariance of the stages reported in columns a and b
+double Analytic::readCovariance(int a, int b) const
+{
+    int sa=report[a], sb=report[b];
+    double cov=Cross(sa,sb)-mean[sa]*mean[sb];
+    // Rounding may leave a tiny negative variance
+    return a==b?std::max(0.0,cov):cov;
+}
+
+// Sensitivities of the mean of a stage to the casting cells
+std::vector<CellSensitivity> Analytic::Sensitivities(int stage) const
+{
+    // Casters on the path of the stage: casting and column leading to it, and mean factor
+    struct Edge {int casting, col; double factor;};
+    std::vector<Edge> path;
+    for(int k=stage;parent[k]>=0;k=parent[k]) if(casting[parent[k]]>=0) path.push_back({casting[parent[k]],column[k],factor[k]});
+    double n=mean[0];
+
+    // d mean / d cell: the mean is n times the product of the column means along the path,
+    // each one linear in the cells of its column
+    std::vector<std::vector<double>> grad(tables.size());
+    for(size_t e=0;e<path.size();++e) {
+        const PlanCasting &t=tables[path[e].casting];
+        std::vector<double> &g=grad[path[e].casting];
+        g.resize(t.cells.size(),0.0);
+        double others=n;
+        for(size_t o=0;o<path.size();++o) if(o!=e) others*=path[o].factor;
+        for(int r=0;r<t.rows;++r) g[r*t.cols+path[e].col]+=others*t.readProbability(r);
+    }
+
+    std::vector<CellSensitivity> cells;
+    double m=mean[stage];
+    for(size_t c=0;c<tables.size();++c) {
+        if(grad[c].empty()) continue;
+        const PlanCasting &t=tables[c];
+        const std::vector<double> &g=grad[c];
+        for(int r=0;r<t.rows;++r) {
+            const float *row=&raw[c][r*t.cols];
+            double sum=0.0;
+            for(int k=0;k<t.cols;++k) sum+=row[k];
+            for(int k=0;k<t.cols;++k) {
+                CellSensitivity s{int(c),r,k,row[k],g[r*t.cols+k],g[r*t.cols+k],0.0};
+                // Full row: what the cell gains, the others lose in proportion to their values
+                double rest=sum-row[k];
+                if(sum>=1.0-1e-6&&rest>0.0)
+                    for(int o=0;o<t.cols;++o) if(o!=k) s.constrained-=g[r*t.cols+o]*row[o]/rest;
+                s.elasticity=m>0.0?s.constrained*s.value/m:0.0;
+                cells.push_back(s);
+            }
+        }
+    }
+    std::stable_sort(cells.begin(),cells.end(),[](const CellSensitivity &a, const CellSensitivity &b) {
+        return std::fabs(a.elasticity)>std::fabs(b.elasticity)||
+               (std::fabs(a.elasticity)==std::fabs(b.elasticity)&&std::fabs(a.constrained)>std::fabs(b.constrained));
+    });
+    return cells;
+}
+
+// Compute the distribution of every reported stage
+bool ExactDistribution::Compute(const Plan &plan, float n, float eps, long cap)
+{
+    int S=plan.readStages();
+    mass.assign(plan.readReported(),{});
+    if(!S) return true;
+
+    // Distribution of the stages waiting for their turn in preorder, dropped once their
+    // following stages have been done
+    std::vector<std::unordered_map<float,double>> dist(S);
+    dist[0][n]=1.0;
+    for(int i=0;i<S;++i) {
+        const PlanNode &nd=plan.readNode(i);
+        auto &d=dist[i];
+        if(nd.slot>=0) {
+            std::vector<Outcome> &m=mass[nd.slot];
+            m.assign(d.begin(),d.end());
+            std::sort(m.begin(),m.end());
+        }
+        switch(nd.kind) {
+        case StageKind::Direct:
+            // Pass the whole lot
+            dist[plan.readKid(nd.first)]=std::move(d);
+            break;
+        case StageKind::Caster: {
+            // Every row with its probability
+            const PlanCasting &t=plan.readCasting(nd.casting);
+            for(int c=0;c<nd.count;++c) {
+                auto &k=dist[plan.readKid(nd.first+c)];
+                for(int r=0;r<t.rows;++r) {
+                    double pr=t.readProbability(r);
+                    if(!(pr>0.0)) continue;
+                    float f=t.cells[r*t.cols+c];
+                    f=f>0.0?f:eps;
+                    for(auto &&o: d) k[o.first*f]+=o.second*pr;
+                    if(long(k.size())>cap) {
+                        mass.assign(plan.readReported(),{});
+                        return false;
+                    }
+                }
+            }
+            break;
+        }
+        default:
+            // Terminal stage: all ends here
+            break;
+        }
+        std::unordered_map<float,double>().swap(d);
+    }
+    return true;
+}
+
+// Mean population of a stage
+double ExactDistribution::readMean(int slot) const
+{
+    double m=0.0;
+    for(auto &&o: mass[slot]) m+=o.first*o.second;
+    return m;
+}
+
+// SD of the population of a stage
+double ExactDistribution::readSD(int slot) const
+{
+    double m=readMean(slot), v=0.0;
+    for(auto &&o: mass[slot]) v+=(o.first-m)*(o.first-m)*o.second;
+    return std::sqrt(v);
+}
+
+// Smallest population whose cumulative probability reaches q
+double ExactDistribution::readQuantile(int slot, double q) const
+{
+    const std::vector<Outcome> &m=mass[slot];
+    if(m.empty()) return 0.0;
+    double cum=0.0;
+    for(auto &&o: m) {
+        cum+=o.second;
+        // Allow for the rounding of the cumulative sum
+        if(cum>=q*(1.0-1e-12)) return o.first;
+    }
+    return m.back().first;
+}
+
+// Largest number of outcomes of a stage
+long ExactDistribution::readMaxOutcomes() const
+{
+    long most=0;
+    for(auto &&m: mass) most=std::max(most,long(m.size()));
+    return most;
+}
@@ -0,0 +1,125 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+#ifndef ANALYTIC_H
+#define ANALYTIC_H
+
+#include <vector>
+#include <cmath>
+#include <utility>
+
+#include "plan.h"
+
+// Sensitivity of the mean population of a stage to a cell of a casting
+struct CellSensitivity {
+    int casting, row, col;  // Cell
+    double value;           // Value of the cell
+    double derivative;      // d mean / d cell
+    double constrained;     // d mean / d cell keeping the row sum of full rows: the other cells shrink in proportion
+    double elasticity;      // Relative change of the mean for a relative change of the cell (constrained)
+};
+
+// Exact moments of the stage populations, without iterating. Every caster draws one of
+// its rows (uniformly or by weight) independently of the others, and populations are
+// linear in the initial one, so the population of a stage is n times a product of
+// independent factors along its path: its mean is n times the product of the column
+// means, and its second moment n^2 times the product of the column second moments.
+// The covariance of two stages only needs the cross moment of the two columns where
+// their paths split.
+// In demographic mode a caster splits its X individuals at random, which adds X times the
+// binomial variance of one individual to the second moments, and a negative multinomial
+// covariance between following stages that share the same individuals (rows adding up to 1
+// at most as entered, scaled back to 1 where quasi-zeros take them above, as they are split).
+class Analytic {
+public:
+    // Compute the moments of every stage of 'plan' for initial population n
+    void Compute(const Plan &plan, float n, float eps, bool demographic=false);
+
+    // Moments of the stage reported in column 'slot'
+    int readReported() const {return int(report.size());}
+    double readMean(int slot) const {return mean[report[slot]];}
+    double readVariance(int slot) const {return readCovariance(slot,slot);}
+    double readSD(int slot) const {return std::sqrt(readVariance(slot));}
+    double readCovariance(int a, int b) const;
+
+    // Sensitivities of the mean of 'stage' (any stage, not only reported ones) to every cell
+    // of the castings on its path, by decreasing absolute elasticity. Casting rows are edited
+    // within the limits of TableModel::setData: cells in [0,1] and row sums up to 1, so an
+    // increase in a full row must come from the other cells.
+    std::vector<CellSensitivity> Sensitivities(int stage) const;
+    double readStageMean(int stage) const {return mean[stage];}
+
+private:
+    // E[X_a X_b] of stages a and b
+    double Cross(int a, int b) const;
+
+    std::vector<int> parent, depth;
+    std::vector<int> column;        // Column of the parent casting feeding the stage (-1: Direct)
+    std::vector<double> factor;     // Mean of the factor applied to the population of the parent
+    std::vector<double> mean, second;
+    // Casting of every caster stage, with the quasi-zero value in place of zeros
+    std::vector<int> casting;
+    std::vector<PlanCasting> tables;
+    std::vector<std::vector<float>> raw;    // Cells as entered, zeros included
+    std::vector<std::vector<char>> exclusive;   // Rows split as a multinomial (demographic mode)
+    std::vector<int> report;
+    bool Demographic;
+
+};
+
+// Exact distribution of the stage populations, by enumerating the rows drawn by the
+// casters along the path of every stage. Equal populations are merged by hashing, so the
+// number of outcomes of a stage is at most the product of the rows of the casters on its
+// path. Populations are multiplied in float along the path as in Plan::Run, so the outcomes
+// are exactly those it draws; the engine, which folds deterministic subtrees into one product,
+// may differ from them in the last bit.
+class ExactDistribution {
+public:
+    static const long MaxOutcomes=100000;
+
+    // Outcome of a stage: population and probability
+    typedef std::pair<float,double> Outcome;
+
+    // Compute the distribution of every reported stage of 'plan' for initial population n.
+    // Returns false, leaving it empty, if a stage has more than 'cap' outcomes.
+    bool Compute(const Plan &plan, float n, float eps, long cap=MaxOutcomes);
+
+    // Distribution of the stage reported in column 'slot', sorted by population
+    int readReported() const {return int(mass.size());}
+    const std::vector<Outcome> &readMass(int slot) const {return mass[slot];}
+    long readOutcomes(int slot) const {return long(mass[slot].size());}
+    double readMean(int slot) const;
+    double readSD(int slot) const;
+    // Smallest population whose cumulative probability reaches q
+    double readQuantile(int slot, double q) const;
+    // Largest number of outcomes of a stage
+    long readMaxOutcomes() const;
+
+private:
+    std::vector<std::vector<Outcome>> mass;
+
+};
+
+#endif // ANALYTIC_H
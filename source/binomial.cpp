@@ -0,0 +1,96 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+#include "binomial.h"
+
+#include <algorithm>
+
+// Binomial draw of n trials with probability p
+double Binomial::Draw(double n, double p, PhiloxStream &stream)
+{
+    if(!(n>=1.0)||!(p>0.0)) return 0.0;
+    if(p>=1.0) return n;
+    // Draw the smaller of successes and failures
+    if(p>0.5) return n-Draw(n,1.0-p,stream);
+    return n*p<10.0?Inversion(n,p,stream):BTRS(n,p,stream);
+}
+
+// Sequential search of the cumulative distribution, O(np)
+double Binomial::Inversion(double n, double p, PhiloxStream &stream)
+{
+    double q=1.0-p, r=p/q, g=r*(n+1.0);
+    double q0=std::exp(n*std::log1p(-p));
+    double bound=std::min(n,n*p+10.0*std::sqrt(n*p*q+1.0));
+    for(;;) {
+        double u=stream.Uniform(), px=q0, x=0.0;
+        while(u>px) {
+            u-=px;
+            x+=1.0;
+            // The tail beyond bound is negligible: start again if rounding got there
+            if(x>bound) break;
+            px*=g/x-r;
+        }
+        if(x<=bound) return x;
+    }
+}
+
+// log(k!) - log(sqrt(2 pi) (k+1)^(k+1/2) e^-(k+1)), the tail of Stirling's formula
+static double StirlingTail(double k)
+{
+    static const double Table[10]={
+        0.0810614667953272, 0.0413406959554092, 0.0276779256849983, 0.02079067210376509,
+        0.0166446911898211, 0.0138761288230707, 0.0118967099458917, 0.010411265261972,
+        0.00925546218271273, 0.00833056343336287 };
+    if(k<=9.0) return Table[int(k)];
+    double k1=k+1.0, k1sq=k1*k1;
+    return (1.0/12.0-(1.0/360.0-1.0/1260.0/k1sq)/k1sq)/k1;
+}
+
+// Transformed rejection with squeeze (Hoermann 1993), for np >= 10: about 1.15 tries per draw
+double Binomial::BTRS(double n, double p, PhiloxStream &stream)
+{
+    double sd=std::sqrt(n*p*(1.0-p));
+    double b=1.15+2.53*sd;
+    double a=-0.0873+0.0248*b+0.01*p;
+    double c=n*p+0.5;
+    double vr=0.92-4.2/b;
+    double r=p/(1.0-p);
+    double alpha=(2.83+5.1/b)*sd;
+    double m=std::floor((n+1.0)*p);
+    for(;;) {
+        double u=stream.Uniform()-0.5, v=stream.Uniform();
+        double us=0.5-std::fabs(u);
+        double k=std::floor((2.0*a/us+b)*u+c);
+        if(k<0.0||k>n) continue;
+        // Squeeze: accepted without the log
+        if(us>=0.07&&v<=vr) return k;
+        v=std::log(v*alpha/(a/(us*us)+b));
+        double bound=(m+0.5)*std::log((m+1.0)/(r*(n-m+1.0)))
+                +(n+1.0)*std::log((n-m+1.0)/(n-k+1.0))
+                +(k+0.5)*std::log(r*(n-k+1.0)/(k+1.0))
+                +StirlingTail(m)+StirlingTail(n-m)-StirlingTail(k)-StirlingTail(n-k);
+        if(v<=bound) return k;
+    }
+}
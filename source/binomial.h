@@ -0,0 +1,91 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+#ifndef BINOMIAL_H
+#define BINOMIAL_H
+
+#include <cmath>
+#include <algorithm>
+
+#include "philox.h"
+
+// Random split of whole individuals among the following stages of a caster (demographic
+// stochasticity). Binomial draws are exact and take O(1) time whatever the population:
+// inversion while the mean is small, transformed rejection (Hoermann's BTRS) beyond.
+class Binomial {
+public:
+    // Binomial draw of n trials with probability p
+    static double Draw(double n, double p, PhiloxStream &stream);
+
+    // True if fractions adding up to 'sum' share the same individuals, which then go to
+    // one following stage at most (the rest die). Larger sums are offspring: every kid
+    // gets floor(f) per individual plus a binomial draw of the fraction, independently.
+    // The sum is that of the cells as entered (Sum): quasi-zeros do not turn a full row
+    // into offspring.
+    static bool Exclusive(double sum) {return sum<=1.0+1e-5;}
+
+    // Sum of the fractions f[c*stride] of 'count' following stages, zeros as entered
+    static double Sum(const float *f, int stride, int count) {
+        double sum=0.0;
+        for(int c=0;c<count;++c) sum+=f[c*stride]>0.0f?f[c*stride]:0.0f;
+        return sum;
+    }
+
+    // Split n individuals by the fractions f[c*stride] of 'count' following stages,
+    // quasi-zero 'eps' in place of zeros, calling out(c, individuals) for every one
+    template<class Out>
+    static void Split(double n, const float *f, int stride, int count, float eps, PhiloxStream &stream, Out out) {
+        if(Exclusive(Sum(f,stride,count))) {
+            // Multinomial, as a chain of binomials on what is left. Quasi-zeros may take a
+            // full row above 1: it is scaled back to 1, so that no individual is made up.
+            double rest=n, mass=0.0;
+            for(int c=0;c<count;++c) mass+=Fraction(f[c*stride],eps);
+            mass=std::max(mass,1.0);
+            for(int c=0;c<count;++c) {
+                double fc=Fraction(f[c*stride],eps);
+                double y=rest>0.0?Draw(rest,mass>fc?fc/mass:1.0,stream):0.0;
+                rest-=y;
+                mass-=fc;
+                out(c,float(y));
+            }
+        } else {
+            for(int c=0;c<count;++c) {
+                double fc=Fraction(f[c*stride],eps), whole=std::floor(fc);
+                out(c,float(n*whole+Draw(n,fc-whole,stream)));
+            }
+        }
+    }
+
+    // Fraction of a casting cell
+    static double Fraction(float f, float eps) {return f>0.0f?f:eps;}
+
+private:
+    // Draws for p <= 0.5
+    static double Inversion(double n, double p, PhiloxStream &stream);
+    static double BTRS(double n, double p, PhiloxStream &stream);
+
+};
+
+#endif // BINOMIAL_H
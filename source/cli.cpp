@@ -0,0 +1,453 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+// stox-cli: runs a StoX model without user interface, for batch work on compute servers
+
+#include "sxmfile.h"
+#include "plan.h"
+#include "engine.h"
+#include "results.h"
+#include "scenarios.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QFileInfo>
+#include <chrono>
+#include <random>
+#include <memory>
+#include <algorithm>
+
+// Statistics are written as tab separated text, which a .npy file name would misrepresent
+static bool NpyName(const QString &filename)
+{
+    return QFileInfo(filename).suffix().toLower()=="npy";
+}
+
+// Merge the state files of several summary runs of the same model, and write their summary
+static int Merge(const QStringList &files, const QString &filename)
+{
+    QTextStream err(stderr);
+    if(files.isEmpty()) {
+        err<<"stox-cli: No state files to merge.\n";
+        return 1;
+    }
+    if(NpyName(filename)) {
+        err<<"stox-cli: Merged statistics are tab separated text, not a .npy array.\n";
+        return 1;
+    }
+    RunInfo total;
+    Summary stats;
+    std::vector<uint64_t> seeds;
+    for(int f=0;f<files.size();++f) {
+        RunInfo info;
+        Summary part;
+        if(!LoadState(files[f].toStdString(),info,part)) {
+            err<<"stox-cli: Couldn't read state from "<<files[f]<<"\n";
+            return 1;
+        }
+        if(f==0) {
+            total=info;
+            stats=part;
+            seeds.push_back(info.Seed);
+            continue;
+        }
+        if(info.ids!=total.ids||info.N!=total.N||info.Eps!=total.Eps||info.Demographic!=total.Demographic||part.readDistributions()!=stats.readDistributions()) {
+            err<<"stox-cli: "<<files[f]<<" is not a run of the same model and parameters.\n";
+            return 1;
+        }
+        if(std::find(seeds.begin(),seeds.end(),info.Seed)!=seeds.end()) {
+            err<<"stox-cli: "<<files[f]<<" was run with the seed of a previous file, so the runs are not independent.\n";
+            return 1;
+        }
+        seeds.push_back(info.Seed);
+        total.Iters+=info.Iters;
+        stats.Merge(part);
+    }
+
+    TsvWriter writer;
+    total.label="Stat";
+    if(!writer.Open(filename.toStdString(),total)||!writer.WriteSummary(stats)||!writer.Close()) {
+        err<<"stox-cli: Couldn't write model output to "<<filename<<"\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Parse a comma separated list of positive values
+static bool ParseList(const QString &text, std::vector<float> &values)
+{
+    values.clear();
+    for(auto &&v: text.split(',',Qt::SkipEmptyParts)) {
+        bool ok;
+        float f=v.trimmed().toFloat(&ok);
+        if(!ok||!(f>0.0f)) return false;
+        values.push_back(f);
+    }
+    return !values.empty();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("stox-cli");
+    QCoreApplication::setApplicationVersion("3.1");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("StoX: Stochastic multistage recruitment model (command line runner)");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("model","StoX model file (*.sxm), or state files to merge with --merge");
+    QCommandLineOption optIters(QStringList()<<"n"<<"iterations","Iterations to run (default 500).","iters","500");
+    QCommandLineOption optInitial(QStringList()<<"i"<<"initial","Initial population (default 10000).","seeds","10000");
+    QCommandLineOption optEps(QStringList()<<"e"<<"eps","Quasi-zero value of the tail of the distribution (default 0.001).","eps","0.001");
+    QCommandLineOption optDemographic(QStringList()<<"d"<<"demographic","Demographic stochasticity: populations are whole individuals, which every caster splits at random among its following stages (multinomial draws with the bootstrapped row as probabilities).");
+    QCommandLineOption optOutput(QStringList()<<"o"<<"output","Write the results to 'file' instead of the standard output (tab separated text, or NumPy array of the iterations for extension .npy).","file");
+    parser.addOption(optIters);
+    parser.addOption(optInitial);
+    parser.addOption(optEps);
+    parser.addOption(optDemographic);
+    QCommandLineOption optSummary(QStringList()<<"s"<<"summary","Keep and write only the summary statistics of every reported stage (mean, SD, SE, min, max, quantiles and histogram).");
+    QCommandLineOption optRSE("rse","Run until the relative standard error of the mean of the target stages reaches 'target' (e.g. 0.01), with --iterations as the maximum.","target");
+    QCommandLineOption optTargets("rse-stages","Comma separated IDs of the target stages of --rse (default: all the reported stages).","ids");
+    QCommandLineOption optExact(QStringList()<<"x"<<"exact","Write the exact mean and SD of every reported stage, computed without iterating. Alone, no iterations are run; with --summary, they follow the summary statistics.");
+    QCommandLineOption optEnumerate("enumerate","If no stage has more than --max-outcomes possible populations, write their exact distribution instead of iterating; otherwise run the Monte Carlo model.");
+    QCommandLineOption optMaxOutcomes("max-outcomes","Largest number of outcomes of a stage for --enumerate (default 100000).","count","100000");
+    QCommandLineOption optMass("mass","With --enumerate, also write every outcome of every reported stage and its probability to 'file'.","file");
+    QCommandLineOption optState("state","In summary mode, also save the accumulators to 'file', to merge them later with those of other runs.","file");
+    QCommandLineOption optMerge("merge","Merge the state files of several summary runs of the same model and write their summary.");
+    QCommandLineOption optSweepN("sweep-initial","Comma separated initial populations to run at once, scaling a single run (summary statistics only).","seeds");
+    QCommandLineOption optSweepEps("sweep-eps","Comma separated quasi-zero values to run at once, reusing the rows drawn (summary statistics only).","eps");
+    QCommandLineOption optSensitivity("sensitivity","Write the sensitivity of the mean of stage 'id' to every cell of the castings on its path (derivative, derivative keeping full row sums, elasticity), ranked by elasticity, instead of running the model.","id");
+    QCommandLineOption optSobol("sobol","Write the first-order and total variance-based (Sobol) indices of every casting for every reported stage, from --iterations Saltelli samples, instead of the results.");
+    QCommandLineOption optSampling("sampling","How the casters draw their rows: random (default), lhs (Latin hypercube over the iterations) or sobol (scrambled Sobol sequence; the casters past the 21st use a Latin hypercube), the last two giving more precise means for the same iterations. Their SE is still that of independent rows (an iid bound), and --rse is not available.","scheme","random");
+    QCommandLineOption optControl("control-variates","Also estimate the mean of every reported stage with the deviations of the casting cells drawn on its path as control variates, writing the corrected mean and SE after the summary statistics (implies --summary; --rse then applies to the corrected SE).");
+    QCommandLineOption optCompare("compare","Run the model and the variants in the comma separated model files with common random numbers (stages with the same path of names draw the same rows), and write the mean of each and its paired difference with the model, with standard errors.","files");
+    QCommandLineOption optScenarios("scenarios","Run every scenario of the grid in 'file', edits of the castings (one axis per line: scale <casting> <row|*> <column|*> <from> <to> <steps>, or replace <casting> <casting>...), in a single run with common random numbers, and write the summary statistics of each one.","file");
+    QCommandLineOption optSeed("seed","Seed of the random generator, to reproduce a run (default: random).","seed");
+    QCommandLineOption optThreads(QStringList()<<"t"<<"threads","Threads to use (default 0: all cores).","threads","0");
+    parser.addOption(optOutput);
+    parser.addOption(optThreads);
+    parser.addOption(optSeed);
+    parser.addOption(optSummary);
+    parser.addOption(optRSE);
+    parser.addOption(optTargets);
+    parser.addOption(optExact);
+    parser.addOption(optEnumerate);
+    parser.addOption(optMaxOutcomes);
+    parser.addOption(optMass);
+    parser.addOption(optState);
+    parser.addOption(optMerge);
+    parser.addOption(optSweepN);
+    parser.addOption(optSweepEps);
+    parser.addOption(optSensitivity);
+    parser.addOption(optSobol);
+    parser.addOption(optSampling);
+    parser.addOption(optControl);
+    parser.addOption(optCompare);
+    parser.addOption(optScenarios);
+    parser.process(a);
+
+    QTextStream err(stderr);
+    if(parser.isSet(optMerge)) return Merge(parser.positionalArguments(),parser.isSet(optOutput)?parser.value(optOutput):"-");
+    if(parser.positionalArguments().size()!=1) {
+        err<<"stox-cli: A single model file is required.\n";
+        return 1;
+    }
+
+    // Read model parameters
+    bool ok1, ok2, ok3, ok4, ok5;
+    int Iters=parser.value(optIters).toInt(&ok1);       // Iterations to run
+    float N=parser.value(optInitial).toFloat(&ok2);     // Initial population
+    float Eps=parser.value(optEps).toFloat(&ok3);       // Quasi-zero value of the tail of the probability distribution
+    int threads=parser.value(optThreads).toInt(&ok4);   // Threads to use
+    long cap=parser.value(optMaxOutcomes).toLong(&ok5); // Largest number of outcomes to enumerate
+    if(!ok1||!ok2||!ok3||!ok4||!ok5||Iters<0) {
+        err<<"stox-cli: Invalid model parameters.\n";
+        return 1;
+    }
+
+    // Seed of the random generator: given, or properly random
+    uint64_t seed;
+    if(parser.isSet(optSeed)) {
+        bool ok;
+        seed=parser.value(optSeed).toULongLong(&ok);
+        if(!ok) {
+            err<<"stox-cli: Invalid seed.\n";
+            return 1;
+        }
+    } else {
+        std::random_device rand_dev;
+        std::mt19937 generator(rand_dev()^
+                               ((std::mt19937::result_type)std::chrono::duration_cast<std::chrono::seconds>
+                                (std::chrono::system_clock::now().time_since_epoch()).count()+
+                                (std::mt19937::result_type)std::chrono::duration_cast<std::chrono::microseconds>
+                                (std::chrono::high_resolution_clock::now().time_since_epoch()).count()));
+        seed=(uint64_t(generator())<<32)|generator();
+    }
+
+    // Read and compile the model
+    SxmFile model;
+    Plan plan;
+    if(!model.Load(parser.positionalArguments().at(0))||!model.Compile(plan)) {
+        err<<"stox-cli: "<<model.readError()<<"\n";
+        return 1;
+    }
+
+    // Sensitivity of the mean of a stage to the castings, computed through the tree
+    if(parser.isSet(optSensitivity)) {
+        std::string id=parser.value(optSensitivity).trimmed().toStdString();
+        int stage=0;
+        while(stage<plan.readStages()&&plan.readID(stage)!=id) stage++;
+        if(stage==plan.readStages()) {
+            err<<"stox-cli: There is no stage "<<parser.value(optSensitivity)<<".\n";
+            return 1;
+        }
+        Analytic moments;
+        moments.Compute(plan,N,Eps,parser.isSet(optDemographic));
+        std::vector<std::string> names;
+        for(auto &&t: model.readCastings()) names.push_back(t.name.toStdString());
+        QString filename=parser.isSet(optOutput)?parser.value(optOutput):"-";
+        if(!WriteSensitivity(filename.toStdString(),moments.Sensitivities(stage),names)) {
+            err<<"stox-cli: Couldn't write model output to "<<filename<<"\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    // Sweeps of the initial population and Eps, which default to the single values given
+    bool sweep=parser.isSet(optSweepN)||parser.isSet(optSweepEps);
+    std::vector<float> sweepN(1,N), sweepEps(1,Eps);
+    if((parser.isSet(optSweepN)&&!ParseList(parser.value(optSweepN),sweepN))||
+       (parser.isSet(optSweepEps)&&!ParseList(parser.value(optSweepEps),sweepEps))) {
+        err<<"stox-cli: Invalid sweep values.\n";
+        return 1;
+    }
+    if(sweep) {
+        // The first values are those of the run
+        N=sweepN[0];
+        Eps=sweepEps[0];
+    }
+    // Row sampling scheme
+    Sampling sampling=Sampling::Random;
+    QString scheme=parser.value(optSampling).toLower();
+    if(scheme=="lhs") sampling=Sampling::LatinHypercube;
+    else if(scheme=="sobol") sampling=Sampling::Sobol;
+    else if(scheme!="random") {
+        err<<"stox-cli: Unknown sampling scheme "<<parser.value(optSampling)<<".\n";
+        return 1;
+    }
+
+    // Stratified rows are not independent: the SE of independent draws overstates their error,
+    // and a hypercube stopped early is not balanced
+    if(sampling!=Sampling::Random&&parser.isSet(optRSE)) {
+        err<<"stox-cli: --rse needs random sampling: the SE of stratified rows is that of independent draws.\n";
+        return 1;
+    }
+    bool sobol=parser.isSet(optSobol);
+    if(sampling!=Sampling::Random&&(sobol||sweep)) {
+        err<<"stox-cli: Sobol indices and sweeps draw their rows at random, without --sampling.\n";
+        return 1;
+    }
+    if(sobol&&(sweep||parser.isSet(optEnumerate)||parser.isSet(optState)||parser.isSet(optRSE))) {
+        err<<"stox-cli: Sobol indices cannot be combined with sweeps, --enumerate, --state or --rse.\n";
+        return 1;
+    }
+    bool compare=parser.isSet(optCompare);
+    if(compare&&(sobol||sweep||sampling!=Sampling::Random||parser.isSet(optControl)||parser.isSet(optEnumerate)||parser.isSet(optState)||parser.isSet(optRSE))) {
+        err<<"stox-cli: Comparisons cannot be combined with Sobol indices, sweeps, --sampling, --control-variates, --enumerate, --state or --rse.\n";
+        return 1;
+    }
+    // Variants of the model, compiled alike
+    std::vector<Plan> variants;
+    std::vector<std::string> variantNames(1,QFileInfo(parser.positionalArguments().at(0)).completeBaseName().toStdString());
+    if(compare) for(auto &&file: parser.value(optCompare).split(',',Qt::SkipEmptyParts)) {
+        SxmFile other;
+        variants.emplace_back();
+        if(!other.Load(file.trimmed())||!other.Compile(variants.back())) {
+            err<<"stox-cli: "<<file.trimmed()<<": "<<other.readError()<<"\n";
+            return 1;
+        }
+        variantNames.push_back(QFileInfo(file.trimmed()).completeBaseName().toStdString());
+    }
+    if(compare&&variants.empty()) {
+        err<<"stox-cli: No model files to compare with.\n";
+        return 1;
+    }
+    bool scenarios=parser.isSet(optScenarios);
+    if(scenarios&&(sobol||sweep||compare||parser.isSet(optControl)||parser.isSet(optEnumerate)||parser.isSet(optState)||parser.isSet(optRSE))) {
+        err<<"stox-cli: Scenario grids cannot be combined with Sobol indices, sweeps, comparisons, --control-variates, --enumerate, --state or --rse.\n";
+        return 1;
+    }
+    // Plans of the scenarios, the castings of the model edited
+    std::vector<Plan> scenarioPlans;
+    std::vector<std::string> scenarioLabels;
+    if(scenarios) {
+        std::vector<std::string> names;
+        for(auto &&t: model.readCastings()) names.push_back(t.name.toStdString());
+        ScenarioGrid grid;
+        if(!grid.Load(parser.value(optScenarios).toStdString(),plan,names)) {
+            err<<"stox-cli: "<<parser.value(optScenarios)<<": "<<QString::fromStdString(grid.readError())<<"\n";
+            return 1;
+        }
+        for(long s=0;s<grid.readScenarios();++s) {
+            scenarioLabels.emplace_back();
+            scenarioPlans.push_back(grid.Build(plan,s,scenarioLabels.back()));
+        }
+    }
+    bool control=parser.isSet(optControl);
+    if(control&&(sobol||sweep||parser.isSet(optState))) {
+        err<<"stox-cli: Control variates cannot be combined with Sobol indices, sweeps or --state.\n";
+        return 1;
+    }
+    if(sweep&&(parser.isSet(optDemographic)||parser.isSet(optEnumerate)||parser.isSet(optState)||parser.isSet(optRSE))) {
+        err<<"stox-cli: Sweeps cannot be combined with --demographic, --enumerate, --state or --rse.\n";
+        return 1;
+    }
+
+    // Exact distribution, when every stage has few enough outcomes
+    bool demographic=parser.isSet(optDemographic);
+    ExactDistribution dist;
+    bool enumerated=false;
+    if(parser.isSet(optEnumerate)&&demographic) err<<"stox-cli: The exact distribution of whole individuals is not enumerated, running the Monte Carlo model instead.\n";
+    else if(parser.isSet(optEnumerate)) {
+        enumerated=dist.Compute(plan,N,Eps,cap);
+        if(!enumerated) err<<"stox-cli: Some stage has more than "<<cap<<" outcomes, running the Monte Carlo model instead.\n";
+    }
+
+    // Open the output, which is written block after block while the model runs
+    QString filename=parser.isSet(optOutput)?parser.value(optOutput):"-";
+    bool summary=parser.isSet(optSummary)||control, exact=parser.isSet(optExact);
+    bool statRows=summary||exact||enumerated||sweep||sobol||compare||scenarios;   // Rows of statistics instead of iterations
+    if(statRows&&NpyName(filename)) {
+        err<<"stox-cli: Statistics are tab separated text, not a .npy array: use another output file name.\n";
+        return 1;
+    }
+    TsvWriter *table=statRows?new TsvWriter:nullptr;    // Writer of the rows of statistics
+    std::unique_ptr<ResultWriter> writer(statRows?table:ResultWriter::Create(filename.toStdString()));
+    RunInfo info(plan,N,Eps,Iters,seed);
+    info.Demographic=demographic;
+    info.sampling=sampling;
+    if(statRows) info.label=sobol?"Index":"Stat";
+    if(!writer->Open(filename.toStdString(),info)) {
+        err<<"stox-cli: Couldn't write model output to "<<filename<<"\n";
+        return 1;
+    }
+
+    // Precision target, if any
+    Precision precision;
+    if(parser.isSet(optRSE)) {
+        bool ok;
+        double rse=parser.value(optRSE).toDouble(&ok);
+        if(!ok||rse<=0.0) {
+            err<<"stox-cli: Invalid target relative standard error.\n";
+            return 1;
+        }
+        std::vector<int> slots;
+        for(auto &&id: parser.value(optTargets).split(',',Qt::SkipEmptyParts)) {
+            auto found=std::find(info.ids.begin(),info.ids.end(),id.trimmed().toStdString());
+            if(found==info.ids.end()) {
+                err<<"stox-cli: Stage "<<id<<" is not reported.\n";
+                return 1;
+            }
+            slots.push_back(int(found-info.ids.begin()));
+        }
+        precision.Init(rse,slots,plan.readReported());
+    }
+
+    // Iterate, in blocks spread over the threads (unless the distribution is known)
+    Engine engine(plan,N,Eps,seed,demographic);
+    engine.setSampling(sampling,Iters);
+    Summary stats;
+    ControlVariates cv;
+    long done=0;
+    bool written=true;  // Every row of statistics written
+    if(sobol) {
+        std::vector<int> groups;
+        SobolIndices indices;
+        done=Engine::Sobol(plan,N,Eps,seed,demographic,Iters,threads,groups,indices,[](long) {return true;});
+        std::vector<std::string> names;
+        for(int g: groups) names.push_back(model.readCastings()[g].name.toStdString());
+        written=table->WriteRows(SobolRows(indices,names))&&written;
+    } else if(compare) {
+        std::vector<const Plan*> plans(1,&plan);
+        for(auto &&v: variants) plans.push_back(&v);
+        std::vector<Summary> runs, diffs;
+        done=Engine::Compare(plans,N,Eps,seed,demographic,Iters,threads,runs,diffs,[](long) {return true;});
+        written=table->WriteRows(ComparisonRows(runs,diffs,variantNames))&&written;
+    } else if(scenarios) {
+        std::vector<Summary> sums;
+        done=Engine::Scenarios(scenarioPlans,N,Eps,seed,demographic,sampling,Iters,threads,true,sums,[](long) {return true;});
+        written=table->WriteRows(ScenarioRows(scenarioLabels,sums,sampling))&&written;
+    } else if(sweep) {
+        std::vector<Summary> sums;
+        done=Engine::Sweep(plan,sweepN,sweepEps,seed,Iters,threads,true,sums,[](long) {return true;});
+        written=table->WriteRows(SweepRows(sweepN,sweepEps,sums))&&written;
+    } else if(enumerated) {
+        written=table->WriteRows(DistributionRows(dist))&&written;
+        if(parser.isSet(optMass)&&!WriteMass(parser.value(optMass).toStdString(),info,dist)) {
+            err<<"stox-cli: Couldn't write model output to "<<parser.value(optMass)<<"\n";
+            return 1;
+        }
+    } else if(summary) {
+        done=engine.Summarize(Iters,threads,true,stats,[&](long) {
+            return !(precision.readActive()&&(control?precision.Reached(cv):precision.Reached(stats)));
+        },control?&cv:nullptr);
+        written=table->WriteSummary(stats)&&written;
+        if(control) written=table->WriteRows(ControlRows(cv,sampling))&&written;
+        info.Iters=done;
+        if(parser.isSet(optState)&&!SaveState(parser.value(optState).toStdString(),info,stats)) {
+            err<<"stox-cli: Couldn't write state to "<<parser.value(optState)<<"\n";
+            return 1;
+        }
+    } else if(!exact) done=engine.Run(Iters,threads,[&](long first, int count, const float *vals) {
+        if(!writer->Write(first,count,vals)) return false;
+        if(!precision.readActive()) return true;
+        precision.Add(count,vals);
+        return !precision.Reached();
+    });
+    if(precision.readActive()&&!enumerated&&(summary||!exact)) {
+        double worst=control?precision.readWorst(cv):summary?precision.readWorst(stats):precision.readWorst();
+        err<<"stox-cli: "<<(worst<=precision.readTarget()?"Target precision reached":"Target precision not reached")
+           <<" after "<<done<<" iterations (worst relative SE "<<worst<<").\n";
+    }
+
+    // Exact moments, in a single sweep over the plan
+    if(exact) {
+        Analytic moments;
+        for(float e: sweepEps) for(float n: sweepN) {
+            moments.Compute(plan,n,e,demographic);
+            std::vector<StatRow> rows=ExactRows(moments);
+            if(sweep) for(auto &&row: rows) row.label=SweepLabel(n,e)+row.label;
+            written=table->WriteRows(rows)&&written;
+        }
+    }
+
+    if(!writer->Close()||!written) {
+        err<<"stox-cli: Couldn't write model output to "<<filename<<"\n";
+        return 1;
+    }
+
+    return 0;
+}
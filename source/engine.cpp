@@ -0,0 +1,527 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+#include "engine.h"
+#include "binomial.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+
+// Constructor
+Engine::Engine(const Plan &p, float n, float eps, uint64_t s, bool demographic):
+    plan(p), N(demographic?std::round(n):n), Eps(eps), seed(s), Demographic(demographic), kernels(Kernels::Best())
+{
+    // Transpose the castings, so that every following stage reads a contiguous column
+    tables.resize(plan.readCastings());
+    for(int t=0;t<plan.readCastings();++t) {
+        const PlanCasting &c=plan.readCasting(t);
+        tables[t].resize(c.cells.size());
+        for(int r=0;r<c.rows;++r) for(int k=0;k<c.cols;++k) {
+            float f=c.cells[r*c.cols+k];
+            tables[t][k*c.rows+r]=f>0.0?f:Eps;
+        }
+    }
+
+    // Every stage draws with the seed of the run, unless told otherwise
+    seeds.assign(plan.readStages(),seed);
+    streams.resize(plan.readStages());
+    for(int i=0;i<plan.readStages();++i) streams[i]=uint32_t(i);
+    // Casters drawing rows take the dimensions of the stratified sequences in preorder,
+    // so that those nearest the start get the best ones
+    dims.assign(plan.readStages(),-1);
+    int dim=0;
+    for(int i=0;i<plan.readStages();++i) {
+        const PlanNode &nd=plan.readNode(i);
+        if(nd.kind==StageKind::Caster&&plan.readCasting(nd.casting).rows>1) dims[i]=dim++;
+    }
+
+    // Subtrees giving the same fractions in every iteration are not walked
+    folds=plan.Fold(Eps,Demographic);
+    foldAt.assign(plan.readStages(),-1);
+    for(int f=0;f<int(folds.size());++f) foldAt[folds[f].root]=f;
+
+    // Control variates: walking up from every reported stage, the column leading to it of every
+    // caster drawing rows, shared by the stages that follow the same column
+    slotControls.assign(plan.readReported(),std::vector<int>());
+    for(int c=0;c<plan.readReported();++c) {
+        for(int kid=plan.readReportedStage(c), i=plan.readNode(kid).parent;i>=0;kid=i, i=plan.readNode(i).parent) {
+            const PlanNode &nd=plan.readNode(i);
+            if(nd.kind!=StageKind::Caster) continue;
+            const PlanCasting &t=plan.readCasting(nd.casting);
+            if(t.rows<=1) continue;
+            int col=0;
+            while(plan.readKid(nd.first+col)!=kid) col++;
+            auto found=std::find_if(controls.begin(),controls.end(),[&](const Control &k) {return k.stage==i&&k.col==col;});
+            if(found==controls.end()) {
+                double mean=0.0;
+                for(int r=0;r<t.rows;++r) mean+=t.readProbability(r)*tables[nd.casting][size_t(col)*t.rows+r];
+                controls.push_back({i,col,mean});
+                found=controls.end()-1;
+            }
+            slotControls[c].push_back(int(found-controls.begin()));
+        }
+    }
+}
+
+// Scratch space for RunBlock
+void Engine::InitScratch(BlockScratch &scratch) const
+{
+    scratch.pop.resize(size_t(plan.readStages())*BlockSize);
+    scratch.rows.resize(BlockSize);
+}
+
+// Draw the casting rows of every caster for a block
+void Engine::DrawRows(long block, int count, int *log) const
+{
+    uint64_t first=uint64_t(block)*BlockSize;
+    for(int i=0;i<plan.readStages();++i) {
+        const PlanNode &nd=plan.readNode(i);
+        if(nd.kind!=StageKind::Caster) continue;
+        const PlanCasting &t=plan.readCasting(nd.casting);
+        if(t.rows>1) Rows(i,t,first,count,log+size_t(i)*BlockSize);
+    }
+}
+
+// Control variates of a block from the rows drawn
+void Engine::Controls(int count, const int *log, double *z) const
+{
+    int K=int(controls.size());
+    for(int k=0;k<K;++k) {
+        const Control &c=controls[k];
+        const int *rows=log+size_t(c.stage)*BlockSize;
+        const PlanCasting &t=plan.readCasting(plan.readNode(c.stage).casting);
+        const float *col=tables[plan.readNode(c.stage).casting].data()+size_t(c.col)*t.rows;
+        for(int j=0;j<count;++j) z[size_t(j)*K+k]=col[rows[j]]-c.mean;
+    }
+}
+
+// Rows drawn by a caster for a block
+void Engine::Rows(int stage, const PlanCasting &t, uint64_t first, int count, int *rows) const
+{
+    switch(sampling) {
+    case Sampling::Random:
+        kernels.Rows(seeds[stage],first,streams[stage],t.rows,t.alias.empty()?nullptr:t.prob.data(),t.alias.data(),rows,count);
+        break;
+    case Sampling::LatinHypercube:
+        for(int j=0;j<count;++j) rows[j]=Sequence::Row(t,Sequence::LatinHypercube(seeds[stage],first+j,uint64_t(total),dims[stage]));
+        break;
+    case Sampling::Sobol:
+        for(int j=0;j<count;++j) rows[j]=Sequence::Row(t,Sequence::Sobol(seeds[stage],first+j,uint64_t(total),dims[stage]));
+        break;
+    }
+}
+
+// Run block number 'block' into vals
+void Engine::RunBlock(long block, int count, BlockScratch &scratch, float *vals, const int *log) const
+{
+    int S=plan.readStages(), R=plan.readReported();
+    if(!S) return;
+    uint64_t first=uint64_t(block)*BlockSize;
+    float *pop=scratch.pop.data();
+    int *rows=scratch.rows.data();
+    std::fill_n(pop,count,N);
+
+    // Preorder: every stage has received the population of the whole block before it is processed
+    for(int i=0;i<S;++i) {
+        const PlanNode &nd=plan.readNode(i);
+        const float *p=pop+size_t(i)*BlockSize;
+        if(nd.slot>=0) for(int j=0;j<count;++j) vals[j*R+nd.slot]=p[j];
+        if(foldAt[i]>=0) {
+            // Deterministic subtree: its reported stages are fixed multiples of this one
+            const PlanFold &fold=folds[foldAt[i]];
+            for(size_t k=0;k<fold.slots.size();++k) {
+                int slot=fold.slots[k];
+                float f=fold.factors[k];
+                for(int j=0;j<count;++j) vals[j*R+slot]=p[j]*f;
+            }
+            i=nd.end-1;
+            continue;
+        }
+        switch(nd.kind) {
+        case StageKind::Direct:
+            // Pass the whole lot
+            std::copy_n(p,count,pop+size_t(plan.readKid(nd.first))*BlockSize);
+            break;
+        case StageKind::Caster: {
+            const PlanCasting &t=plan.readCasting(nd.casting);
+            const float *cols=tables[nd.casting].data();
+            // Bootstrap a row per iteration
+            const int *drawn=rows;
+            if(t.rows<=1) {
+                if(Demographic) std::fill_n(rows,count,0);
+            } else if(log) drawn=log+size_t(i)*BlockSize;
+            else Rows(i,t,first,count,rows);
+            if(Demographic) {
+                // Binomial draws branch too much for vectors: split every iteration on its own,
+                // by the row as entered, whose zeros tell shared individuals from offspring
+                for(int j=0;j<count;++j) {
+                    PhiloxStream stream(seeds[i],first+j,streams[i]);
+                    Binomial::Split(p[j],&t.cells[size_t(drawn[j])*t.cols],1,nd.count,Eps,stream,[&](int c, float y) {
+                        pop[size_t(plan.readKid(nd.first+c))*BlockSize+j]=y;
+                    });
+                }
+            } else if(t.rows>1) {
+                // Distribute the lot
+                for(int c=0;c<nd.count;++c)
+                    kernels.Gather(p,cols+c*t.rows,drawn,pop+size_t(plan.readKid(nd.first+c))*BlockSize,count);
+            } else {
+                for(int c=0;c<nd.count;++c)
+                    kernels.Scale(p,cols[c],pop+size_t(plan.readKid(nd.first+c))*BlockSize,count);
+            }
+            break;
+        }
+        default:
+            // Terminal stage: all ends here
+            break;
+        }
+    }
+}
+
+// Threads actually used for 'iters' iterations
+int Engine::Threads(long iters, int threads) const
+{
+    if(threads<=0) threads=int(std::max(1u,std::thread::hardware_concurrency()));
+    long B=(iters+BlockSize-1)/BlockSize;
+    if(threads>B) threads=int(std::max(1L,B));
+    return threads;
+}
+
+// Run 'iters' iterations on 'threads' threads
+long Engine::Run(long iters, int threads, const BlockSink &sink)
+{
+    threads=Threads(iters,threads);
+    int R=plan.readReported();
+
+    // Blocks computed but not yet delivered wait in a ring of slots, which bounds the memory used
+    int S=2*threads;
+    std::vector<std::vector<float>> slots(S,std::vector<float>(size_t(BlockSize)*std::max(R,1)));
+    return Process(iters,threads,S,[&](long block, int count, int slot, BlockScratch &scratch) {
+        RunBlock(block,count,scratch,slots[slot].data());
+    },[&](long block, int count, int slot) {
+        return sink(block*BlockSize,count,slots[slot].data());
+    });
+}
+
+// Run 'iters' iterations keeping only the summary statistics
+long Engine::Summarize(long iters, int threads, bool dist, Summary &summary, const ProgressSink &progress, ControlVariates *control)
+{
+    threads=Threads(iters,threads);
+    int R=plan.readReported(), K=int(controls.size());
+    summary.Init(R,dist);
+    if(control) control->Init(slotControls,K);
+
+    int S=2*threads;
+    std::vector<Summary> slots(S);
+    std::vector<ControlVariates> cvs(control?S:0);
+    std::vector<std::vector<float>> vals(S,std::vector<float>(size_t(BlockSize)*std::max(R,1)));
+    std::vector<std::vector<double>> z(control?S:0,std::vector<double>(size_t(BlockSize)*K));
+    return Process(iters,threads,S,[&](long block, int count, int slot, BlockScratch &scratch) {
+        if(control) {
+            // The rows drawn are kept for the controls
+            scratch.log.resize(size_t(plan.readStages())*BlockSize);
+            DrawRows(block,count,scratch.log.data());
+            RunBlock(block,count,scratch,vals[slot].data(),scratch.log.data());
+            Controls(count,scratch.log.data(),z[slot].data());
+            cvs[slot].Init(slotControls,K);
+            cvs[slot].Add(count,vals[slot].data(),z[slot].data());
+        } else RunBlock(block,count,scratch,vals[slot].data());
+        slots[slot].Init(R,dist);
+        slots[slot].Add(count,vals[slot].data());
+    },[&](long block, int count, int slot) {
+        summary.Merge(slots[slot]);
+        if(control) control->Merge(cvs[slot]);
+        return progress(block*BlockSize+count);
+    });
+}
+
+// Run all the combinations of initial populations and quasi-zero values at once
+long Engine::Sweep(const Plan &plan, const std::vector<float> &ns, const std::vector<float> &eps, uint64_t seed,
+                   long iters, int threads, bool dist, std::vector<Summary> &summaries, const ProgressSink &progress)
+{
+    int R=plan.readReported(), K=int(ns.size()), E=int(eps.size());
+    summaries.assign(size_t(K)*E,Summary());
+    if(!K||!E) return 0;
+    for(auto &&s: summaries) s.Init(R,dist);
+
+    // One engine per Eps, at the first N
+    std::vector<std::unique_ptr<Engine>> engines;
+    for(float e: eps) engines.emplace_back(new Engine(plan,ns[0],e,seed));
+    const Engine &base=*engines[0];
+    std::vector<float> scale(K);
+    for(int k=0;k<K;++k) scale[k]=ns[k]/ns[0];
+
+    threads=base.Threads(iters,threads);
+    int S=2*threads;
+    std::vector<std::vector<Summary>> slots(S,std::vector<Summary>(size_t(K)*E));
+    std::vector<std::vector<float>> vals(S,std::vector<float>(size_t(BlockSize)*std::max(R,1)*2));
+    return engines[0]->Process(iters,threads,S,[&](long block, int count, int slot, BlockScratch &scratch) {
+        scratch.log.resize(size_t(plan.readStages())*BlockSize);
+        base.DrawRows(block,count,scratch.log.data());
+        float *v=vals[slot].data(), *scaled=v+size_t(BlockSize)*std::max(R,1);
+        for(int e=0;e<E;++e) {
+            engines[e]->RunBlock(block,count,scratch,v,scratch.log.data());
+            for(int k=0;k<K;++k) {
+                Summary &s=slots[slot][size_t(e)*K+k];
+                s.Init(R,dist);
+                if(k==0) s.Add(count,v);
+                else {
+                    for(size_t j=0;j<size_t(count)*R;++j) scaled[j]=v[j]*scale[k];
+                    s.Add(count,scaled);
+                }
+            }
+        }
+    },[&](long block, int count, int slot) {
+        for(size_t c=0;c<summaries.size();++c) summaries[c].Merge(slots[slot][c]);
+        return progress(block*BlockSize+count);
+    });
+}
+
+// Variance-based sensitivity indices of the castings
+long Engine::Sobol(const Plan &plan, float n, float eps, uint64_t seed, bool demographic, long iters, int threads,
+                   std::vector<int> &groups, SobolIndices &sobol, const ProgressSink &progress)
+{
+    int R=plan.readReported();
+    // Inputs: the draws of every casting used by a caster
+    groups.clear();
+    for(int i=0;i<plan.readStages();++i) {
+        const PlanNode &nd=plan.readNode(i);
+        if(nd.kind==StageKind::Caster&&std::find(groups.begin(),groups.end(),nd.casting)==groups.end()) groups.push_back(nd.casting);
+    }
+    std::sort(groups.begin(),groups.end());
+    int G=int(groups.size());
+    sobol.Init(G,R);
+
+    // Run A draws with the seed, run B with an unrelated key, and run AB_i as A but for the
+    // stages of casting i, which draw as in B
+    uint64_t seedB=seed^0x9E3779B97F4A7C15ull;
+    Engine a(plan,n,eps,seed,demographic), b(plan,n,eps,seedB,demographic);
+    std::vector<std::unique_ptr<Engine>> ab;
+    for(int g=0;g<G;++g) {
+        ab.emplace_back(new Engine(plan,n,eps,seed,demographic));
+        for(int i=0;i<plan.readStages();++i) if(plan.readNode(i).casting==groups[g]) ab[g]->seeds[i]=seedB;
+    }
+
+    threads=a.Threads(iters,threads);
+    int S=2*threads;
+    size_t block=size_t(BlockSize)*std::max(R,1);
+    std::vector<SobolIndices> slots(S);
+    std::vector<std::vector<float>> vals(S,std::vector<float>(block*(G+2)));
+    return a.Process(iters,threads,S,[&](long blk, int count, int slot, BlockScratch &scratch) {
+        float *v=vals[slot].data();
+        a.RunBlock(blk,count,scratch,v);
+        b.RunBlock(blk,count,scratch,v+block);
+        std::vector<const float*> runs(G);
+        for(int g=0;g<G;++g) {
+            ab[g]->RunBlock(blk,count,scratch,v+block*(g+2));
+            runs[g]=v+block*(g+2);
+        }
+        slots[slot].Init(G,R);
+        slots[slot].Add(count,v,v+block,runs);
+    },[&](long blk, int count, int slot) {
+        sobol.Merge(slots[slot]);
+        return progress(blk*BlockSize+count);
+    });
+}
+
+// Paired comparison of variants of a model with common random numbers
+long Engine::Compare(const std::vector<const Plan*> &plans, float n, float eps, uint64_t seed, bool demographic, long iters,
+                     int threads, std::vector<Summary> &runs, std::vector<Summary> &diffs, const ProgressSink &progress)
+{
+    int V=int(plans.size());
+    runs.clear();
+    diffs.clear();
+    if(V<2) return 0;
+    const Plan &base=*plans[0];
+    int R=base.readReported();
+    runs.assign(V,Summary());
+    diffs.assign(V-1,Summary());
+    for(auto &&s: runs) s.Init(R);
+    for(auto &&s: diffs) s.Init(R);
+
+    // Engines drawing by path, and the column of every reported stage of the first plan in each variant
+    std::vector<std::unique_ptr<Engine>> engines;
+    std::vector<std::vector<int>> columns(V,std::vector<int>(R,-1));
+    std::vector<std::string> paths(R);
+    for(int c=0;c<R;++c) paths[c]=base.readPath(base.readReportedStage(c));
+    int widest=1, largest=0;
+    for(int v=0;v<V;++v) {
+        const Plan &p=*plans[v];
+        engines.emplace_back(new Engine(p,n,eps,seed,demographic));
+        engines[v]->streams=p.Keys();
+        std::unordered_map<std::string,int> reported;
+        for(int k=p.readReported()-1;k>=0;--k) reported[p.readPath(p.readReportedStage(k))]=k;
+        for(int c=0;c<R;++c) {
+            auto found=reported.find(paths[c]);
+            if(found!=reported.end()) columns[v][c]=found->second;
+        }
+        widest=std::max(widest,p.readReported());
+        if(p.readStages()>plans[largest]->readStages()) largest=v;
+    }
+
+    threads=engines[0]->Threads(iters,threads);
+    int S=2*threads;
+    std::vector<std::vector<Summary>> slots(S,std::vector<Summary>(2*V-1));
+    std::vector<std::vector<float>> vals(S,std::vector<float>(size_t(BlockSize)*(widest+2*std::max(R,1))));
+    return engines[0]->Process(iters,threads,S,[&](long block, int count, int slot, BlockScratch &scratch) {
+        float *v=vals[slot].data(), *first=v+size_t(BlockSize)*widest, *mapped=first+size_t(BlockSize)*std::max(R,1);
+        // Variants may have more stages than the first plan: size the scratch of the worker for the largest
+        if(scratch.pop.size()<size_t(plans[largest]->readStages())*BlockSize) engines[largest]->InitScratch(scratch);
+        for(int k=0;k<V;++k) {
+            const Engine &e=*engines[k];
+            e.RunBlock(block,count,scratch,v);
+            int Rk=e.plan.readReported();
+            float *out=k?mapped:first;
+            for(int j=0;j<count;++j) for(int c=0;c<R;++c)
+                out[size_t(j)*R+c]=columns[k][c]>=0?v[size_t(j)*Rk+columns[k][c]]:0.0f;
+            Summary &run=slots[slot][k];
+            run.Init(R);
+            run.Add(count,out);
+            if(!k) continue;
+            for(size_t j=0;j<size_t(count)*R;++j) mapped[j]-=first[j];
+            Summary &diff=slots[slot][V+k-1];
+            diff.Init(R);
+            diff.Add(count,mapped);
+        }
+    },[&](long block, int count, int slot) {
+        for(int k=0;k<V;++k) runs[k].Merge(slots[slot][k]);
+        for(int k=1;k<V;++k) diffs[k-1].Merge(slots[slot][V+k-1]);
+        return progress(block*BlockSize+count);
+    });
+}
+
+// Whether two castings draw the same rows
+static bool SameDraws(const PlanCasting &a, const PlanCasting &b)
+{
+    return a.rows==b.rows&&a.prob==b.prob&&a.alias==b.alias;
+}
+
+// Run every scenario of a grid
+long Engine::Scenarios(const std::vector<Plan> &plans, float n, float eps, uint64_t seed, bool demographic, Sampling sampling,
+                       long iters, int threads, bool dist, std::vector<Summary> &summaries, const ProgressSink &progress)
+{
+    int P=int(plans.size());
+    summaries.assign(P,Summary());
+    if(!P) return 0;
+    int R=plans[0].readReported();
+    for(auto &&s: summaries) s.Init(R,dist);
+
+    std::vector<std::unique_ptr<Engine>> engines;
+    std::vector<char> redraw(P,0);
+    for(int k=0;k<P;++k) {
+        engines.emplace_back(new Engine(plans[k],n,eps,seed,demographic));
+        engines[k]->setSampling(sampling,iters);
+        for(int t=0;t<plans[k].readCastings();++t) if(!SameDraws(plans[k].readCasting(t),plans[0].readCasting(t))) redraw[k]=1;
+    }
+    const Engine &base=*engines[0];
+
+    threads=base.Threads(iters,threads);
+    int S=2*threads;
+    size_t stages=size_t(plans[0].readStages())*BlockSize;
+    std::vector<std::vector<Summary>> slots(S,std::vector<Summary>(P));
+    std::vector<std::vector<float>> vals(S,std::vector<float>(size_t(BlockSize)*std::max(R,1)));
+    std::vector<std::vector<int>> own(S);
+    return engines[0]->Process(iters,threads,S,[&](long block, int count, int slot, BlockScratch &scratch) {
+        scratch.log.resize(stages);
+        base.DrawRows(block,count,scratch.log.data());
+        for(int k=0;k<P;++k) {
+            const int *log=scratch.log.data();
+            if(redraw[k]) {
+                own[slot].resize(stages);
+                engines[k]->DrawRows(block,count,own[slot].data());
+                log=own[slot].data();
+            }
+            engines[k]->RunBlock(block,count,scratch,vals[slot].data(),log);
+            Summary &s=slots[slot][k];
+            s.Init(R,dist);
+            s.Add(count,vals[slot].data());
+        }
+    },[&](long block, int count, int slot) {
+        for(int k=0;k<P;++k) summaries[k].Merge(slots[slot][k]);
+        return progress(block*BlockSize+count);
+    });
+}
+
+// Run the blocks of 'iters' iterations on 'threads' threads
+long Engine::Process(long iters, int threads, int S, const BlockWork &work, const BlockDeliver &deliver)
+{
+    long B=(iters+BlockSize-1)/BlockSize;
+
+    // A block is computed into slot (block % S) only once the block S places before it has been delivered
+    std::vector<char> ready(S,0);
+    long next=0;        // Next block to compute
+    long done=0;        // Next block to deliver
+    bool stop=false;
+    std::mutex m;
+    std::condition_variable cv;
+
+    auto worker=[&]() {
+        BlockScratch scratch;
+        InitScratch(scratch);
+        for(;;) {
+            long b;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock,[&]{return stop||next>=B||next<done+S;});
+                if(stop||next>=B) return;
+                b=next++;
+            }
+            int count=int(std::min<long>(BlockSize,iters-b*BlockSize));
+            work(b,count,int(b%S),scratch);
+            {
+                std::lock_guard<std::mutex> lock(m);
+                ready[b%S]=1;
+            }
+            cv.notify_all();
+        }
+    };
+    std::vector<std::thread> pool;
+    for(int t=0;t<threads;++t) pool.emplace_back(worker);
+
+    // Deliver the blocks in order
+    while(done<B) {
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock,[&]{return ready[done%S]!=0;});
+        }
+        int count=int(std::min<long>(BlockSize,iters-done*BlockSize));
+        bool goon=deliver(done,count,int(done%S));
+        {
+            std::lock_guard<std::mutex> lock(m);
+            ready[done%S]=0;
+            done++;
+            if(!goon) stop=true;
+        }
+        cv.notify_all();
+        if(!goon) break;
+    }
+
+    for(auto &&t: pool) t.join();
+
+    return std::min(iters,done*BlockSize);
+}
@@ -0,0 +1,165 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <functional>
+#include <cstdint>
+#include <vector>
+
+#include "plan.h"
+#include "stats.h"
+#include "kernels.h"
+#include "sampling.h"
+
+// Receives the results of a block of consecutive iterations, [count x reported stages]
+// starting at iteration 'first' (0-based). Returning false aborts the run.
+typedef std::function<bool(long first, int count, const float *vals)> BlockSink;
+
+// Receives the number of iterations done so far. Returning false aborts the run.
+typedef std::function<bool(long done)> ProgressSink;
+
+// Working memory of a thread: the population of every stage for a whole block of
+// iterations, stage after stage [stages x BlockSize], the casting rows drawn, and the
+// log of the rows drawn by every caster of the block [stages x BlockSize] (sweeps only)
+struct BlockScratch {
+    std::vector<float> pop;
+    std::vector<int> rows;
+    std::vector<int> log;
+};
+
+// Multi-threaded iteration engine. Iterations are split into blocks of BlockSize spread
+// over the threads. Random draws come from a counter-based generator keyed by the seed and
+// the iteration number, so that a given seed gives the same results whatever the number
+// of threads or the block size.
+class Engine {
+public:
+    static const int BlockSize=1024;
+
+    // In 'demographic' mode populations are whole individuals, which casters split at random
+    Engine(const Plan &p, float n, float eps, uint64_t s, bool demographic=false);
+
+    // Draw the casting rows from stratified sequences instead of independently, for runs of
+    // 'iters' iterations (the size of a Latin hypercube, and of the casters past the Sobol dimensions)
+    void setSampling(Sampling s, long iters) {sampling=s; total=iters;}
+
+    // Run 'iters' iterations on 'threads' threads (0: all cores). Blocks are delivered
+    // to the sink in order, from the calling thread. Returns the iterations delivered.
+    long Run(long iters, int threads, const BlockSink &sink);
+
+    // Run 'iters' iterations keeping only the summary statistics of the reported stages,
+    // with their distributions if 'dist'. Each block is summarized by the thread that runs it,
+    // and block summaries are merged in order, so the result does not depend on the number
+    // of threads either.
+    // With 'control', the means are also estimated with control variates: for every reported
+    // stage, the deviations from their expected values of the cells drawn on its path by the
+    // casters before it, whose rows are known.
+    long Summarize(long iters, int threads, bool dist, Summary &summary, const ProgressSink &progress, ControlVariates *control=nullptr);
+
+    // Run 'iters' iterations of 'plan' once for all the combinations of initial populations 'ns'
+    // and quasi-zero values 'eps', keeping the summary statistics of each one into summaries
+    // [eps x ns]. Rows do not depend on Eps: they are drawn once per iteration into a log that
+    // every Eps reuses. Populations are linear in N: each N is the first one scaled.
+    static long Sweep(const Plan &plan, const std::vector<float> &ns, const std::vector<float> &eps, uint64_t seed,
+                      long iters, int threads, bool dist, std::vector<Summary> &summaries, const ProgressSink &progress);
+
+    // First-order and total variance-based (Sobol) indices of the castings for every reported
+    // stage, from 'iters' Saltelli samples of N and Eps. The inputs are the rows drawn from each
+    // casting used by a caster (and, in demographic mode, its random splits), groups being
+    // their plan indices. Each sample runs the model (castings+2) times, all in the same block.
+    static long Sobol(const Plan &plan, float n, float eps, uint64_t seed, bool demographic, long iters, int threads,
+                      std::vector<int> &groups, SobolIndices &sobol, const ProgressSink &progress);
+
+    // Paired comparison of variants of a model with common random numbers: every stage draws with
+    // the key of its path (Plan::Keys), so that the stages the variants share draw the same rows
+    // in every iteration. The reported stages of the first plan are found by path in the others
+    // (zero where missing). Keeps the summary of every variant [plans], on the columns of the first,
+    // and of the differences of every other one with the first [plans-1].
+    static long Compare(const std::vector<const Plan*> &plans, float n, float eps, uint64_t seed, bool demographic, long iters,
+                        int threads, std::vector<Summary> &runs, std::vector<Summary> &diffs, const ProgressSink &progress);
+
+    // Run 'iters' iterations of every scenario 'plans', variants of a model that differ only in their
+    // castings (ScenarioGrid::Build), keeping the summary statistics of each one into summaries.
+    // Rows are drawn once per block into a log that every scenario reuses, but those whose castings
+    // draw differently (other rows or weights) redraw all: castings left alike draw the same rows
+    // anyway, so scenarios are compared with common random numbers.
+    static long Scenarios(const std::vector<Plan> &plans, float n, float eps, uint64_t seed, bool demographic, Sampling sampling,
+                          long iters, int threads, bool dist, std::vector<Summary> &summaries, const ProgressSink &progress);
+
+    // Run block number 'block' [count iterations] into vals. Every stage is processed for
+    // the whole block at once, with vector kernels. Casting rows are drawn, or read from
+    // a log written by DrawRows.
+    void RunBlock(long block, int count, BlockScratch &scratch, float *vals, const int *log=nullptr) const;
+
+    // Draw the casting rows of every caster for block number 'block' into log [stages x BlockSize]
+    void DrawRows(long block, int count, int *log) const;
+
+    // Scratch space for RunBlock
+    void InitScratch(BlockScratch &scratch) const;
+
+private:
+    // Run the blocks of 'iters' iterations on 'threads' threads. 'work' processes a block on
+    // a worker thread, into one of 'slots' result slots. 'deliver' is then called from the
+    // calling thread with the blocks in order, and may stop the run by returning false.
+    typedef std::function<void(long block, int count, int slot, BlockScratch &scratch)> BlockWork;
+    typedef std::function<bool(long block, int count, int slot)> BlockDeliver;
+    long Process(long iters, int threads, int slots, const BlockWork &work, const BlockDeliver &deliver);
+
+    // Threads actually used for 'iters' iterations
+    int Threads(long iters, int threads) const;
+
+    // Control variates of a block from the rows drawn, z [count x controls]
+    void Controls(int count, const int *log, double *z) const;
+
+    // Rows of casting t drawn by caster 'stage' for iterations first..first+count-1
+    void Rows(int stage, const PlanCasting &t, uint64_t first, int count, int *rows) const;
+
+    const Plan &plan;
+    float N;        // Initial population
+    float Eps;      // The quasi-zero value of the distribution tail
+    uint64_t seed;  // Seed of the whole run
+    bool Demographic;   // Whole individuals split at random
+    std::vector<uint64_t> seeds;    // Seed of the draws of every stage
+    std::vector<uint32_t> streams;  // Key of the draws of every stage: its position, unless told otherwise
+    Sampling sampling=Sampling::Random;
+    long total=0;           // Iterations stratified by a Latin hypercube
+    std::vector<int> dims;  // Dimension of the stratified sequences of every caster drawing rows (-1: none)
+    // Casting tables with the quasi-zero value in place of zeros, column after column
+    std::vector<std::vector<float>> tables;
+    // Deterministic subtrees, and the one starting at every stage (-1: none)
+    std::vector<PlanFold> folds;
+    std::vector<int> foldAt;
+    // Control variate: the cell of column 'col' in the row drawn by caster 'stage', less its mean
+    struct Control {
+        int stage, col;
+        double mean;
+    };
+    std::vector<Control> controls;
+    std::vector<std::vector<int>> slotControls; // Controls of every reported stage
+    const Kernels &kernels;
+
+};
+
+#endif // ENGINE_H
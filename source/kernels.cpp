@@ -0,0 +1,235 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+#include "kernels.h"
+#include "philox.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STOX_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+// Scalar kernels
+
+static void RowsScalar(uint64_t seed, uint64_t first, uint32_t stage, int n, const uint32_t *prob, const int *alias, int *rows, int count)
+{
+    if(!prob) {
+        for(int j=0;j<count;++j) rows[j]=Philox::Below(Philox::Word(seed,first+j,stage),n);
+        return;
+    }
+    for(int j=0;j<count;++j) {
+        uint64_t it=first+j;
+        uint32_t w[4];
+        Philox::Draw(seed,uint32_t(it),uint32_t(it>>32),stage,0,w);
+        int r=Philox::Below(w[0],n);
+        rows[j]=w[1]<prob[r]?r:alias[r];
+    }
+}
+
+static void ScaleScalar(const float *pop, float f, float *kid, int count)
+{
+    for(int j=0;j<count;++j) kid[j]=pop[j]*f;
+}
+
+static void GatherScalar(const float *pop, const float *col, const int *rows, float *kid, int count)
+{
+    for(int j=0;j<count;++j) kid[j]=pop[j]*col[rows[j]];
+}
+
+#ifdef STOX_X86_KERNELS
+
+// AVX2 kernels, 8 iterations at a time
+
+// High and low words of the 32x32 bit products of every lane of a by m
+__attribute__((target("avx2"))) static inline void MulHiLo8(__m256i a, __m256i m, __m256i &hi, __m256i &lo)
+{
+    __m256i even=_mm256_mul_epu32(a,m);
+    __m256i odd=_mm256_mul_epu32(_mm256_srli_epi64(a,32),m);
+    lo=_mm256_blend_epi32(even,_mm256_slli_epi64(odd,32),0xAA);
+    hi=_mm256_blend_epi32(_mm256_srli_epi64(even,32),odd,0xAA);
+}
+
+__attribute__((target("avx2"))) static void RowsAVX2(uint64_t seed, uint64_t first, uint32_t stage, int n, const uint32_t *prob, const int *alias, int *rows, int count)
+{
+    const __m256i sign=_mm256_set1_epi32(int(0x80000000));
+    const __m256i M0=_mm256_set1_epi32(int(0xD2511F53)), M1=_mm256_set1_epi32(int(0xCD9E8D57));
+    const __m256i N=_mm256_set1_epi32(n);
+    int j=0;
+    for(;j+8<=count;j+=8) {
+        uint32_t lo[8], hi[8];
+        for(int l=0;l<8;++l) {
+            uint64_t it=first+j+l;
+            lo[l]=uint32_t(it);
+            hi[l]=uint32_t(it>>32);
+        }
+        __m256i c0=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(lo));
+        __m256i c1=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(hi));
+        __m256i c2=_mm256_set1_epi32(int(stage)), c3=_mm256_setzero_si256();
+        uint32_t k0=uint32_t(seed), k1=uint32_t(seed>>32);
+        for(int r=0;r<10;++r) {
+            __m256i h0, l0, h1, l1;
+            MulHiLo8(c0,M0,h0,l0);
+            MulHiLo8(c2,M1,h1,l1);
+            c0=_mm256_xor_si256(_mm256_xor_si256(h1,c1),_mm256_set1_epi32(int(k0)));
+            c2=_mm256_xor_si256(_mm256_xor_si256(h0,c3),_mm256_set1_epi32(int(k1)));
+            c1=l1;
+            c3=l0;
+            k0+=0x9E3779B9;
+            k1+=0xBB67AE85;
+        }
+        __m256i h, l;
+        MulHiLo8(c0,N,h,l);
+        if(prob) {
+            // Keep the row if the second word is below its probability (unsigned), else take its alias
+            __m256i p=_mm256_i32gather_epi32(reinterpret_cast<const int*>(prob),h,4);
+            __m256i a=_mm256_i32gather_epi32(alias,h,4);
+            __m256i keep=_mm256_cmpgt_epi32(_mm256_xor_si256(p,sign),_mm256_xor_si256(c1,sign));
+            h=_mm256_blendv_epi8(a,h,keep);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(rows+j),h);
+    }
+    RowsScalar(seed,first+j,stage,n,prob,alias,rows+j,count-j);
+}
+
+__attribute__((target("avx2"))) static void ScaleAVX2(const float *pop, float f, float *kid, int count)
+{
+    __m256 vf=_mm256_set1_ps(f);
+    int j=0;
+    for(;j+8<=count;j+=8) _mm256_storeu_ps(kid+j,_mm256_mul_ps(_mm256_loadu_ps(pop+j),vf));
+    ScaleScalar(pop+j,f,kid+j,count-j);
+}
+
+__attribute__((target("avx2"))) static void GatherAVX2(const float *pop, const float *col, const int *rows, float *kid, int count)
+{
+    int j=0;
+    for(;j+8<=count;j+=8) {
+        __m256i idx=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows+j));
+        __m256 f=_mm256_i32gather_ps(col,idx,4);
+        _mm256_storeu_ps(kid+j,_mm256_mul_ps(_mm256_loadu_ps(pop+j),f));
+    }
+    GatherScalar(pop+j,col,rows+j,kid+j,count-j);
+}
+
+// AVX-512 kernels, 16 iterations at a time
+// (GCC 12 warns about the undefined vectors inside its own AVX-512 intrinsics, GCC bug 105593)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f"))) static inline void MulHiLo16(__m512i a, __m512i m, __m512i &hi, __m512i &lo)
+{
+    __m512i even=_mm512_mul_epu32(a,m);
+    __m512i odd=_mm512_mul_epu32(_mm512_srli_epi64(a,32),m);
+    lo=_mm512_mask_blend_epi32(0xAAAA,even,_mm512_slli_epi64(odd,32));
+    hi=_mm512_mask_blend_epi32(0xAAAA,_mm512_srli_epi64(even,32),odd);
+}
+
+__attribute__((target("avx512f"))) static void RowsAVX512(uint64_t seed, uint64_t first, uint32_t stage, int n, const uint32_t *prob, const int *alias, int *rows, int count)
+{
+    const __m512i M0=_mm512_set1_epi32(int(0xD2511F53)), M1=_mm512_set1_epi32(int(0xCD9E8D57));
+    const __m512i N=_mm512_set1_epi32(n);
+    int j=0;
+    for(;j+16<=count;j+=16) {
+        uint32_t lo[16], hi[16];
+        for(int l=0;l<16;++l) {
+            uint64_t it=first+j+l;
+            lo[l]=uint32_t(it);
+            hi[l]=uint32_t(it>>32);
+        }
+        __m512i c0=_mm512_loadu_si512(lo);
+        __m512i c1=_mm512_loadu_si512(hi);
+        __m512i c2=_mm512_set1_epi32(int(stage)), c3=_mm512_setzero_si512();
+        uint32_t k0=uint32_t(seed), k1=uint32_t(seed>>32);
+        for(int r=0;r<10;++r) {
+            __m512i h0, l0, h1, l1;
+            MulHiLo16(c0,M0,h0,l0);
+            MulHiLo16(c2,M1,h1,l1);
+            c0=_mm512_xor_si512(_mm512_xor_si512(h1,c1),_mm512_set1_epi32(int(k0)));
+            c2=_mm512_xor_si512(_mm512_xor_si512(h0,c3),_mm512_set1_epi32(int(k1)));
+            c1=l1;
+            c3=l0;
+            k0+=0x9E3779B9;
+            k1+=0xBB67AE85;
+        }
+        __m512i h, l;
+        MulHiLo16(c0,N,h,l);
+        if(prob) {
+            // Keep the row if the second word is below its probability, else take its alias
+            __m512i p=_mm512_i32gather_epi32(h,prob,4);
+            __m512i a=_mm512_i32gather_epi32(h,alias,4);
+            h=_mm512_mask_blend_epi32(_mm512_cmplt_epu32_mask(c1,p),a,h);
+        }
+        _mm512_storeu_si512(rows+j,h);
+    }
+    RowsAVX2(seed,first+j,stage,n,prob,alias,rows+j,count-j);
+}
+
+__attribute__((target("avx512f"))) static void ScaleAVX512(const float *pop, float f, float *kid, int count)
+{
+    __m512 vf=_mm512_set1_ps(f);
+    int j=0;
+    for(;j+16<=count;j+=16) _mm512_storeu_ps(kid+j,_mm512_mul_ps(_mm512_loadu_ps(pop+j),vf));
+    ScaleAVX2(pop+j,f,kid+j,count-j);
+}
+
+__attribute__((target("avx512f"))) static void GatherAVX512(const float *pop, const float *col, const int *rows, float *kid, int count)
+{
+    int j=0;
+    for(;j+16<=count;j+=16) {
+        __m512i idx=_mm512_loadu_si512(rows+j);
+        __m512 f=_mm512_i32gather_ps(idx,col,4);
+        _mm512_storeu_ps(kid+j,_mm512_mul_ps(_mm512_loadu_ps(pop+j),f));
+    }
+    GatherAVX2(pop+j,col,rows+j,kid+j,count-j);
+}
+
+#pragma GCC diagnostic pop
+
+#endif // STOX_X86_KERNELS
+
+// Pick the best kernels for this CPU
+static Kernels Pick()
+{
+    static const Kernels scalar={RowsScalar,ScaleScalar,GatherScalar,"scalar"};
+    const char *ask=std::getenv("STOX_KERNELS");
+    if(ask&&!std::strcmp(ask,"scalar")) return scalar;
+#ifdef STOX_X86_KERNELS
+    __builtin_cpu_init();
+    bool avx2=__builtin_cpu_supports("avx2");
+    bool avx512=avx2&&__builtin_cpu_supports("avx512f");
+    if(avx512&&!(ask&&!std::strcmp(ask,"avx2"))) return Kernels{RowsAVX512,ScaleAVX512,GatherAVX512,"avx512"};
+    if(avx2) return Kernels{RowsAVX2,ScaleAVX2,GatherAVX2,"avx2"};
+#endif
+    return scalar;
+}
+
+// Best kernels for this CPU, picked at first use
+const Kernels &Kernels::Best()
+{
+    static const Kernels best=Pick();
+    return best;
+}
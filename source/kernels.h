@@ -0,0 +1,52 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstdint>
+
+// Kernels of the batched engine, working on a block of iterations at once with the
+// population of every stage stored as a column (structure of arrays). Vector versions
+// (AVX2, AVX-512) are picked at runtime when the CPU has them, with a scalar fallback.
+// All of them give exactly the same results as one another, and as the scalar Plan::Run
+// for the stages walked; stages in folded deterministic subtrees may differ in the last bit.
+struct Kernels {
+    // Bootstrap rows of a casting of n rows for iterations first..first+count-1 at 'stage',
+    // as PlanCasting::Row: uniform if 'prob' is null, else through the alias table (prob, alias)
+    void (*Rows)(uint64_t seed, uint64_t first, uint32_t stage, int n, const uint32_t *prob, const int *alias, int *rows, int count);
+    // Casting of a single row: kid[j]=pop[j]*f
+    void (*Scale)(const float *pop, float f, float *kid, int count);
+    // Casting of the bootstrapped rows: kid[j]=pop[j]*col[rows[j]]
+    void (*Gather)(const float *pop, const float *col, const int *rows, float *kid, int count);
+    // Name of the instruction set
+    const char *name;
+
+    // Best kernels for this CPU. Environment variable STOX_KERNELS (scalar, avx2, avx512)
+    // may ask for a lower instruction set, to compare them.
+    static const Kernels &Best();
+};
+
+#endif // KERNELS_H
@@ -0,0 +1,103 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <cstdint>
+
+// Philox4x32-10 counter-based random generator (Salmon et al., SC'11).
+// Every draw is a pure function of a 64-bit key and a 128-bit counter, so any
+// draw can be computed on its own, from any thread, without shared state or warm-up.
+// The model keys it with the run seed and counts with (iteration, stage, draw).
+class Philox {
+public:
+    // Four random 32-bit words for counter (c0,c1,c2,c3) and key 'seed'
+    static void Draw(uint64_t seed, uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t out[4]) {
+        uint32_t k0=uint32_t(seed), k1=uint32_t(seed>>32);
+        for(int r=0;r<10;++r) {
+            uint64_t p0=uint64_t(M0)*c0, p1=uint64_t(M1)*c2;
+            uint32_t n0=uint32_t(p1>>32)^c1^k0, n2=uint32_t(p0>>32)^c3^k1;
+            c1=uint32_t(p1);
+            c3=uint32_t(p0);
+            c0=n0;
+            c2=n2;
+            k0+=W0;
+            k1+=W1;
+        }
+        out[0]=c0; out[1]=c1; out[2]=c2; out[3]=c3;
+    }
+
+    // First random 32-bit word of draw 'draw' of stage 'stage' in iteration 'iter'
+    static uint32_t Word(uint64_t seed, uint64_t iter, uint32_t stage, uint32_t draw=0) {
+        uint32_t out[4];
+        Draw(seed,uint32_t(iter),uint32_t(iter>>32),stage,draw,out);
+        return out[0];
+    }
+
+    // Uniform integer in [0,n) from a random 32-bit word (multiply and shift: the bias,
+    // below n/2^32, is negligible for the table sizes of a model)
+    static int Below(uint32_t word, int n) {return int((uint64_t(word)*uint32_t(n))>>32);}
+
+    // Uniform float in [0,1) from a random 32-bit word
+    static float Unit(uint32_t word) {return float(word>>8)*(1.0f/16777216.0f);}
+
+private:
+    static const uint32_t M0=0xD2511F53, M1=0xCD9E8D57;  // Round multipliers
+    static const uint32_t W0=0x9E3779B9, W1=0xBB67AE85;  // Key schedule (Weyl sequence)
+
+};
+
+// Random words of stage 'stage' in iteration 'iter', for draws that need an unknown number
+// of them (rejection sampling). Counters (iter, stage, 1), (iter, stage, 2)... follow the one
+// of the row draw, (iter, stage, 0), so a stream never reuses it.
+class PhiloxStream {
+public:
+    PhiloxStream(uint64_t s, uint64_t iter, uint32_t st): seed(s), c0(uint32_t(iter)), c1(uint32_t(iter>>32)), stage(st), block(0), pos(4) {}
+
+    // Next random 32-bit word
+    uint32_t Next() {
+        if(pos==4) {
+            Philox::Draw(seed,c0,c1,stage,++block,buf);
+            pos=0;
+        }
+        return buf[pos++];
+    }
+
+    // Uniform double in (0,1), with 53 random bits
+    double Uniform() {
+        uint64_t a=Next()>>5, b=Next()>>6;
+        return (double((a<<26)|b)+0.5)*(1.0/9007199254740992.0);
+    }
+
+private:
+    uint64_t seed;
+    uint32_t c0, c1, stage, block;
+    uint32_t buf[4];
+    int pos;
+
+};
+
+#endif // PHILOX_H
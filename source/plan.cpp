@@ -0,0 +1,232 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+#include "plan.h"
+#include "binomial.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+
+// Empty the plan
+void Plan::Clear()
+{
+    nodes.clear();
+    kids.clear();
+    castings.clear();
+    names.clear();
+    ids.clear();
+    report.clear();
+    reported=0;
+}
+
+// Add a casting table [rows x cols], returns its index
+int Plan::AddCasting(int rows, int cols, const float *cells, const float *weights)
+{
+    PlanCasting t{rows,cols,std::vector<float>(cells,cells+rows*cols),{},double(rows),{},{}};
+    // Equal weights need no alias table
+    if(weights&&rows>1&&std::any_of(weights+1,weights+rows,[&](float w) {return w!=weights[0];})) {
+        t.weights.assign(weights,weights+rows);
+        t.total=0.0;
+        for(float w: t.weights) t.total+=w;
+
+        // Vose: split the rows whose scaled probability is below 1 from the others, and
+        // fill every small one up to 1 with a large one
+        std::vector<double> p(rows);
+        std::vector<int> small, large;
+        for(int r=0;r<rows;++r) {
+            p[r]=t.weights[r]*rows/t.total;
+            (p[r]<1.0?small:large).push_back(r);
+        }
+        t.prob.assign(rows,0xFFFFFFFFu);
+        t.alias.resize(rows);
+        for(int r=0;r<rows;++r) t.alias[r]=r;
+        while(!small.empty()&&!large.empty()) {
+            int s=small.back(), l=large.back();
+            small.pop_back();
+            t.prob[s]=uint32_t(std::ldexp(p[s],32));
+            t.alias[s]=l;
+            p[l]-=1.0-p[s];
+            if(p[l]<1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // What is left has probability 1 (up to rounding): always kept
+    }
+    castings.push_back(std::move(t));
+    return int(castings.size())-1;
+}
+
+// Scale cells of a casting
+void Plan::ScaleCasting(int t, int row, int col, float factor)
+{
+    PlanCasting &c=castings[t];
+    for(int r=0;r<c.rows;++r) for(int k=0;k<c.cols;++k)
+        if((row<0||r==row)&&(col<0||k==col)) c.cells[r*c.cols+k]*=factor;
+}
+
+// Add a stage following stage 'parent', returns its index
+int Plan::AddStage(int parent, StageKind kind, int casting, bool rep, const std::string &name, const std::string &id)
+{
+    int i=int(nodes.size());
+    nodes.push_back(PlanNode{kind,parent,0,0,kind==StageKind::Caster?casting:-1,rep?reported++:-1,i+1});
+    names.push_back(name);
+    ids.push_back(id);
+    if(rep) report.push_back(i);
+    return i;
+}
+
+// Link every stage to its following stages
+void Plan::Finish()
+{
+    int S=int(nodes.size());
+    // Count following stages
+    for(auto &&nd: nodes) nd.first=nd.count=0;
+    for(auto &&nd: nodes) if(nd.parent>=0) nodes[nd.parent].count++;
+    // Reserve a contiguous range for each stage
+    int pos=0;
+    for(auto &&nd: nodes) {nd.first=pos; pos+=nd.count; nd.count=0;}
+    // Fill the ranges, keeping the order of siblings in the tree
+    kids.assign(pos,0);
+    for(int i=0;i<S;++i) {
+        int p=nodes[i].parent;
+        if(p>=0) kids[nodes[p].first+nodes[p].count++]=i;
+    }
+    // Subtrees are contiguous in preorder: extend every one up to its last stage
+    for(int i=0;i<S;++i) nodes[i].end=i+1;
+    for(int i=S-1;i>=0;--i) {
+        int p=nodes[i].parent;
+        if(p>=0) nodes[p].end=std::max(nodes[p].end,nodes[i].end);
+    }
+}
+
+// Names of the stages from Start to stage i, separated by a control character no name has
+std::string Plan::readPath(int i) const
+{
+    std::string path=names[i];
+    for(int p=nodes[i].parent;p>=0;p=nodes[p].parent) path=names[p]+'\x1f'+path;
+    return path;
+}
+
+// Key of the random draws of every stage, from its path (FNV-1a), hashed on from the path of
+// its parent, which comes first in preorder
+std::vector<uint32_t> Plan::Keys() const
+{
+    int S=int(nodes.size());
+    std::vector<uint64_t> hash(S);
+    std::vector<uint32_t> keys(S);
+    std::unordered_set<uint32_t> used;
+    for(int i=0;i<S;++i) {
+        uint64_t h=0xCBF29CE484222325ull;
+        if(nodes[i].parent>=0) h=(hash[nodes[i].parent]^0x1Fu)*0x100000001B3ull;
+        for(unsigned char ch: names[i]) h=(h^ch)*0x100000001B3ull;
+        hash[i]=h;
+        uint32_t k=uint32_t(h^(h>>32));
+        while(!used.insert(k).second) k=k*0x9E3779B1u+1;
+        keys[i]=k;
+    }
+    return keys;
+}
+
+// Find the largest deterministic subtrees
+std::vector<PlanFold> Plan::Fold(float eps, bool demographic) const
+{
+    int S=int(nodes.size());
+    // Whether the whole subtree of every stage is deterministic, following stages first
+    std::vector<char> fixed(S);
+    for(int i=S-1;i>=0;--i) {
+        const PlanNode &nd=nodes[i];
+        bool f=nd.kind!=StageKind::Caster||(!demographic&&castings[nd.casting].rows==1);
+        for(int c=0;c<nd.count&&f;++c) f=fixed[kids[nd.first+c]];
+        fixed[i]=f;
+    }
+
+    std::vector<PlanFold> folds;
+    std::vector<double> factor(S);
+    for(int i=0;i<S;++i) {
+        const PlanNode &nd=nodes[i];
+        if(!fixed[i]||(nd.parent>=0&&fixed[nd.parent])||nd.end-i<2) continue;
+        // Fractions of the population of the root, in preorder
+        PlanFold fold{i,{},{}};
+        factor[i]=1.0;
+        for(int j=i;j<nd.end;++j) {
+            const PlanNode &n=nodes[j];
+            if(j>i&&n.slot>=0) {
+                fold.slots.push_back(n.slot);
+                fold.factors.push_back(float(factor[j]));
+            }
+            for(int c=0;c<n.count;++c) {
+                double f=1.0;
+                if(n.kind==StageKind::Caster) {
+                    f=castings[n.casting].cells[c];
+                    if(!(f>0.0)) f=eps;
+                }
+                factor[kids[n.first+c]]=factor[j]*f;
+            }
+        }
+        folds.push_back(std::move(fold));
+    }
+    return folds;
+}
+
+// Run one iteration
+void Plan::Run(float n, float eps, uint64_t seed, uint64_t iter, float *pop, float *out, bool demographic) const
+{
+    int S=int(nodes.size());
+    if(!S) return;
+    pop[0]=demographic?std::round(n):n;
+    // Preorder: every stage has received its population before it is processed
+    for(int i=0;i<S;++i) {
+        const PlanNode &nd=nodes[i];
+        float p=pop[i];
+        if(nd.slot>=0) out[nd.slot]=p;
+        switch(nd.kind) {
+        case StageKind::Direct:
+            // Pass the whole lot
+            pop[kids[nd.first]]=p;
+            break;
+        case StageKind::Caster: {
+            const PlanCasting &t=castings[nd.casting];
+            // Bootstrap
+            int r=t.Row(seed,iter,uint32_t(i));
+            // Distribute the lot
+            const float *row=&t.cells[r*t.cols];
+            if(demographic) {
+                PhiloxStream stream(seed,iter,uint32_t(i));
+                Binomial::Split(p,row,1,nd.count,eps,stream,[&](int c, float y) {pop[kids[nd.first+c]]=y;});
+                break;
+            }
+            for(int c=0;c<nd.count;++c) {
+                float f=row[c];
+                pop[kids[nd.first+c]]=p*(f>0.0?f:eps);
+            }
+            break;
+        }
+        default:
+            // Terminal stage: all ends here
+            break;
+        }
+    }
+}
@@ -0,0 +1,160 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "philox.h"
+
+// Stage types, in the same order as the type names shown in the user interface
+enum class StageKind : unsigned char { Direct, Caster, Success, Sink };
+
+// Compiled stage: everything needed to process it during a model run
+struct PlanNode {
+    StageKind kind;
+    int parent;     // Index of the preceding stage (-1 for Start)
+    int first;      // Position of the first following stage in the list of kids
+    int count;      // Number of following stages
+    int casting;    // Index of the casting table (Caster stages only, -1 otherwise)
+    int slot;       // Column of the stage in the iteration results (-1 if not reported)
+    int end;        // End of the subtree of the stage: its following stages are the ones up to end-1
+};
+
+// Subtree that gives the same fraction of its population to every stage in every iteration
+// (only Direct stages and casters of a single row), folded into a multiplier per reported stage
+struct PlanFold {
+    int root;                   // First stage of the subtree
+    std::vector<int> slots;     // Columns of the reported stages that follow it
+    std::vector<float> factors; // Population of each of them per individual at the root
+};
+
+// Casting table copied out of the user interface, rows stored one after the other.
+// Rows are drawn with equal probability, or in proportion to their weights through an
+// alias table (Walker/Vose), which draws any row in O(1).
+struct PlanCasting {
+    int rows, cols;
+    std::vector<float> cells;
+    std::vector<float> weights;     // Weight of every row (empty: all equal)
+    double total;                   // Sum of the weights
+    std::vector<uint32_t> prob;     // Alias table: probability of keeping the row, scaled by 2^32
+    std::vector<int> alias;         // Alias table: row drawn instead
+
+    // Probability of drawing row r
+    double readProbability(int r) const {return weights.empty()?1.0/rows:weights[r]/total;}
+
+    // Row drawn at 'stage' in iteration 'iter'
+    int Row(uint64_t seed, uint64_t iter, uint32_t stage) const {
+        if(rows<=1) return 0;
+        if(alias.empty()) return Philox::Below(Philox::Word(seed,iter,stage),rows);
+        uint32_t w[4];
+        Philox::Draw(seed,uint32_t(iter),uint32_t(iter>>32),stage,0,w);
+        int r=Philox::Below(w[0],rows);
+        return w[1]<prob[r]?r:alias[r];
+    }
+};
+
+// The model tree compiled into a flat execution plan, free of any Qt widget.
+// Stages are stored in preorder, so every stage comes after the one feeding it,
+// and a single sweep over the array processes a whole iteration.
+class Plan {
+public:
+    Plan() {Clear();}
+
+    // Empty the plan
+    void Clear();
+
+    // Add a casting table [rows x cols] with optional row weights [rows], returns its index.
+    // Weights must be non-negative, with a positive sum.
+    int AddCasting(int rows, int cols, const float *cells, const float *weights=nullptr);
+
+    // Add a stage following stage 'parent' (-1 for Start), returns its index.
+    // Stages must be added in preorder (the order of QTreeWidgetItemIterator).
+    int AddStage(int parent, StageKind kind, int casting, bool report, const std::string &name, const std::string &id);
+
+    // Link every stage to its following stages once all of them have been added
+    void Finish();
+
+    // Edit casting t, for scenarios: scale its cells of row 'row' and column 'col' (-1: all)
+    void ScaleCasting(int t, int row, int col, float factor);
+    // Put a copy of casting 'source', with as many columns, in place of casting t
+    void ReplaceCasting(int t, int source) {castings[t]=castings[source];}
+
+    // Find the largest deterministic subtrees of two stages or more, for quasi-zero value eps.
+    // In demographic mode casters always split at random, so only Direct stages fold.
+    std::vector<PlanFold> Fold(float eps, bool demographic) const;
+
+    // Run iteration 'iter' with initial population n, writing the reported stages to out.
+    // Random draws depend only on (seed, iter, stage), so any iteration can be rerun alone.
+    // 'pop' is scratch space for the population of every stage [readStages()], so that
+    // several threads can run the same plan at once.
+    // In 'demographic' mode populations are whole individuals, which casters split at random.
+    // This is the reference of the Engine, which runs folded subtrees in one product: their
+    // populations may differ from these in the last bit.
+    void Run(float n, float eps, uint64_t seed, uint64_t iter, float *pop, float *out, bool demographic=false) const;
+
+    // Read sizes
+    int readStages() const {return int(nodes.size());}
+    int readReported() const {return reported;}
+    int readCastings() const {return int(castings.size());}
+
+    // Read compiled data
+    const PlanNode &readNode(int i) const {return nodes[i];}
+    const PlanCasting &readCasting(int i) const {return castings[i];}
+    int readKid(int i) const {return kids[i];}
+
+    // Names of the stages from Start to stage i, which identify a stage across variants of a model
+    std::string readPath(int i) const;
+
+    // Key of the random draws of every stage, from its path instead of its position, so that the
+    // stages that variants of a model share draw alike whatever was added or removed elsewhere
+    // (stages with the same path in a model get distinct keys, in preorder)
+    std::vector<uint32_t> Keys() const;
+
+    // Read stage labels (UTF-8)
+    const std::string &readName(int i) const {return names[i];}
+    const std::string &readID(int i) const {return ids[i];}
+    // Stage reported in column 'slot' of the iteration results
+    int readReportedStage(int slot) const {return report[slot];}
+
+private:
+    // Stages in preorder
+    std::vector<PlanNode> nodes;
+    // Following stages of every stage, contiguous for each one
+    std::vector<int> kids;
+    // Casting tables
+    std::vector<PlanCasting> castings;
+    // Stage names and hierarchical IDs
+    std::vector<std::string> names, ids;
+    // Reported stages, by column of the iteration results
+    std::vector<int> report;
+    // Number of reported stages
+    int reported;
+
+};
+
+#endif // PLAN_H
@@ -0,0 +1,573 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+#include "results.h"
+
+#include <iostream>
+#include <filesystem>
+#include <cstdio>
+#include <cstdint>
+#include <cctype>
+#include <algorithm>
+
+// Name of a row sampling scheme
+const char *SamplingName(Sampling s)
+{
+    switch(s) {
+    case Sampling::LatinHypercube: return "Latin hypercube";
+    case Sampling::Sobol: return "Sobol";
+    default: return "Random";
+    }
+}
+
+// Modes of a run that change its results
+std::vector<std::string> RunModes(const RunInfo &info)
+{
+    std::vector<std::string> modes;
+    if(info.Demographic) modes.push_back("Demographic");
+    if(info.sampling!=Sampling::Random) modes.push_back(SamplingName(info.sampling));
+    return modes;
+}
+
+// Label of the standard errors of a run
+std::string ErrorLabel(Sampling sampling)
+{
+    return sampling==Sampling::Random?"SE":"SE (iid bound)";
+}
+
+// Summary statistics laid out as rows
+std::vector<StatRow> SummaryRows(const Summary &summary, bool histogram, Sampling sampling)
+{
+    std::vector<StatRow> rows;
+    int R=summary.readReported();
+    std::string labels[]={"Mean","SD",ErrorLabel(sampling),"Min","Max","N"};
+    for(int k=0;k<6;++k) {
+        StatRow row{labels[k],{}};
+        for(int c=0;c<R;++c) {
+            const Moments &m=summary.readStage(c);
+            double v[]={m.readMean(),m.readSD(),m.readSE(),m.readMin(),m.readMax(),double(m.readCount())};
+            row.vals.push_back(v[k]);
+        }
+        rows.push_back(row);
+    }
+    if(!summary.readDistributions()) return rows;
+
+    // Quantiles: median and 95% interval
+    const char *qlabels[]={"Q2.5%","Median","Q97.5%"};
+    double qs[]={0.025,0.5,0.975};
+    for(int k=0;k<3;++k) {
+        StatRow row{qlabels[k],{}};
+        for(int c=0;c<R;++c) row.vals.push_back(summary.readSketch(c).readQuantile(qs[k]));
+        rows.push_back(row);
+    }
+
+    if(!histogram) return rows;
+
+    // Histogram, from the lowest to the highest bin used by any stage
+    int lo=LogHistogram::Bins, hi=-1;
+    for(int c=0;c<R;++c) for(int b=0;b<LogHistogram::Bins;++b) if(summary.readHistogram(c).readCount(b)) {
+        lo=std::min(lo,b);
+        hi=std::max(hi,b);
+    }
+    char num[32];
+    for(int b=lo;b<=hi;++b) {
+        snprintf(num,sizeof(num),">=%g",LogHistogram::readLower(b));
+        StatRow row{num,{}};
+        for(int c=0;c<R;++c) row.vals.push_back(double(summary.readHistogram(c).readCount(b)));
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+// Variance-based sensitivity indices
+std::vector<StatRow> SobolRows(const SobolIndices &sobol, const std::vector<std::string> &names)
+{
+    std::vector<StatRow> rows;
+    int R=sobol.readReported();
+    StatRow var{"Variance",{}};
+    for(int c=0;c<R;++c) var.vals.push_back(sobol.readVariance(c));
+    rows.push_back(var);
+    for(int g=0;g<sobol.readGroups();++g) {
+        StatRow first{"S1 "+names[g],{}}, total{"ST "+names[g],{}};
+        for(int c=0;c<R;++c) {
+            first.vals.push_back(sobol.readFirst(g,c));
+            total.vals.push_back(sobol.readTotal(g,c));
+        }
+        rows.push_back(first);
+        rows.push_back(total);
+    }
+    return rows;
+}
+
+// Label prefix of the rows of a combination of a sweep
+std::string SweepLabel(float n, float eps)
+{
+    char num[64];
+    snprintf(num,sizeof(num),"N=%g Eps=%g ",double(n),double(eps));
+    return num;
+}
+
+// Summary statistics of every combination of a sweep
+std::vector<StatRow> SweepRows(const std::vector<float> &ns, const std::vector<float> &eps, const std::vector<Summary> &summaries)
+{
+    std::vector<StatRow> rows;
+    for(size_t e=0;e<eps.size();++e) for(size_t k=0;k<ns.size();++k) {
+        std::string label=SweepLabel(ns[k],eps[e]);
+        for(auto &&row: SummaryRows(summaries[e*ns.size()+k],false)) {
+            row.label=label+row.label;
+            rows.push_back(std::move(row));
+        }
+    }
+    return rows;
+}
+
+// Summary statistics of every scenario of a grid
+std::vector<StatRow> ScenarioRows(const std::vector<std::string> &labels, const std::vector<Summary> &summaries, Sampling sampling)
+{
+    std::vector<StatRow> rows;
+    for(size_t k=0;k<summaries.size();++k) for(auto &&row: SummaryRows(summaries[k],false,sampling)) {
+        row.label=labels[k]+" "+row.label;
+        rows.push_back(std::move(row));
+    }
+    return rows;
+}
+
+// Paired comparison of variants of a model
+std::vector<StatRow> ComparisonRows(const std::vector<Summary> &runs, const std::vector<Summary> &diffs, const std::vector<std::string> &names)
+{
+    std::vector<StatRow> rows;
+    for(size_t v=0;v<runs.size();++v) {
+        StatRow mean{names[v]+" Mean",{}};
+        for(int c=0;c<runs[v].readReported();++c) mean.vals.push_back(runs[v].readStage(c).readMean());
+        rows.push_back(mean);
+    }
+    for(size_t v=0;v<diffs.size();++v) {
+        const std::string &name=names[v+1];
+        StatRow diff{name+" Diff",{}}, se{name+" Diff SE",{}}, unpaired{name+" Unpaired SE",{}};
+        for(int c=0;c<diffs[v].readReported();++c) {
+            const Moments &d=diffs[v].readStage(c);
+            diff.vals.push_back(d.readMean());
+            se.vals.push_back(d.readSE());
+            // SE of the difference of two independent runs of the same length
+            double a=runs[0].readStage(c).readSE(), b=runs[v+1].readStage(c).readSE();
+            unpaired.vals.push_back(std::sqrt(a*a+b*b));
+        }
+        rows.push_back(diff);
+        rows.push_back(se);
+        rows.push_back(unpaired);
+    }
+    return rows;
+}
+
+// Exact mean and SD of every reported stage
+std::vector<StatRow> ExactRows(const Analytic &exact)
+{
+    std::vector<StatRow> rows{{"Exact mean",{}},{"Exact SD",{}}};
+    for(int c=0;c<exact.readReported();++c) {
+        rows[0].vals.push_back(exact.readMean(c));
+        rows[1].vals.push_back(exact.readSD(c));
+    }
+    return rows;
+}
+
+// Means corrected with control variates
+std::vector<StatRow> ControlRows(const ControlVariates &cv, Sampling sampling)
+{
+    std::vector<StatRow> rows{{"CV mean",{}},{"CV "+ErrorLabel(sampling),{}},{"CV explained",{}}};
+    for(int c=0;c<cv.readReported();++c) {
+        rows[0].vals.push_back(cv.readMean(c));
+        rows[1].vals.push_back(cv.readSE(c));
+        rows[2].vals.push_back(cv.readExplained(c));
+    }
+    return rows;
+}
+
+// Exact distribution of every reported stage
+std::vector<StatRow> DistributionRows(const ExactDistribution &exact)
+{
+    int R=exact.readReported();
+    std::vector<StatRow> rows{{"Exact mean",{}},{"Exact SD",{}},{"Exact Q2.5%",{}},{"Exact median",{}},{"Exact Q97.5%",{}},{"Outcomes",{}}};
+    std::vector<std::vector<double>> hist(R,std::vector<double>(LogHistogram::Bins,0.0));
+    int lo=LogHistogram::Bins, hi=-1;
+    for(int c=0;c<R;++c) {
+        rows[0].vals.push_back(exact.readMean(c));
+        rows[1].vals.push_back(exact.readSD(c));
+        rows[2].vals.push_back(exact.readQuantile(c,0.025));
+        rows[3].vals.push_back(exact.readQuantile(c,0.5));
+        rows[4].vals.push_back(exact.readQuantile(c,0.975));
+        rows[5].vals.push_back(double(exact.readOutcomes(c)));
+        for(auto &&o: exact.readMass(c)) {
+            int b=LogHistogram::Bin(o.first);
+            hist[c][b]+=o.second;
+            lo=std::min(lo,b);
+            hi=std::max(hi,b);
+        }
+    }
+
+    // Probability of every bin, from the lowest to the highest bin used by any stage
+    char num[32];
+    for(int b=lo;b<=hi;++b) {
+        snprintf(num,sizeof(num),"p >=%g",LogHistogram::readLower(b));
+        StatRow row{num,{}};
+        for(int c=0;c<R;++c) row.vals.push_back(hist[c][b]);
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+// Write the whole exact distribution of every reported stage
+bool WriteMass(const std::string &filename, const RunInfo &info, const ExactDistribution &exact)
+{
+    std::ofstream file;
+    std::ostream *out=&std::cout;
+    if(filename!="-") {
+        file.open(std::filesystem::u8path(filename),std::ios::out|std::ios::trunc);
+        if(!file) return false;
+        out=&file;
+    }
+    *out<<"ID\tName\tPopulation\tProbability\n";
+    char num[64];
+    for(int c=0;c<exact.readReported();++c) for(auto &&o: exact.readMass(c)) {
+        snprintf(num,sizeof(num),"\t%.9g\t%.17g\n",double(o.first),o.second);
+        *out<<info.ids[c]<<"\t"<<info.names[c]<<num;
+    }
+    out->flush();
+    return bool(*out);
+}
+
+// Write the sensitivities of the mean of a stage to the casting cells, ranked
+bool WriteSensitivity(const std::string &filename, const std::vector<CellSensitivity> &cells, const std::vector<std::string> &castings)
+{
+    std::ofstream file;
+    std::ostream *out=&std::cout;
+    if(filename!="-") {
+        file.open(std::filesystem::u8path(filename),std::ios::out|std::ios::trunc);
+        if(!file) return false;
+        out=&file;
+    }
+    *out<<"Casting\tRow\tColumn\tValue\tDerivative\tConstrained\tElasticity\n";
+    char num[128];
+    for(auto &&s: cells) {
+        snprintf(num,sizeof(num),"\t%d\t%d\t%g\t%.9g\t%.9g\t%.9g\n",s.row+1,s.col+1,s.value,s.derivative,s.constrained,s.elasticity);
+        *out<<castings[s.casting]<<num;
+    }
+    out->flush();
+    return bool(*out);
+}
+
+// Raw binary values and strings
+template<class T> static void Put(std::ostream &out, const T &v) {out.write(reinterpret_cast<const char*>(&v),sizeof(v));}
+template<class T> static void Get(std::istream &in, T &v) {in.read(reinterpret_cast<char*>(&v),sizeof(v));}
+static void PutString(std::ostream &out, const std::string &s) {
+    int32_t n=int32_t(s.size());
+    Put(out,n);
+    out.write(s.data(),n);
+}
+static void GetString(std::istream &in, std::string &s) {
+    int32_t n=0;
+    Get(in,n);
+    if(n<0||n>(1<<20)) {in.setstate(std::ios::failbit); return;}
+    s.resize(n);
+    in.read(&s[0],n);
+}
+
+static const char StateMagic[8]={'S','T','O','X','S','U','M','3'};
+
+// Save the accumulators of a summary-only run
+bool SaveState(const std::string &filename, const RunInfo &info, const Summary &summary)
+{
+    std::ofstream file(std::filesystem::u8path(filename),std::ios::out|std::ios::binary|std::ios::trunc);
+    if(!file) return false;
+    file.write(StateMagic,sizeof(StateMagic));
+    Put(file,info.N);
+    Put(file,info.Eps);
+    int64_t iters=info.Iters;
+    Put(file,iters);
+    Put(file,info.Seed);
+    char demographic=info.Demographic;
+    Put(file,demographic);
+    int32_t R=int32_t(info.ids.size());
+    Put(file,R);
+    for(int c=0;c<R;++c) {
+        PutString(file,info.ids[c]);
+        PutString(file,info.names[c]);
+    }
+    summary.Save(file);
+    file.close();
+    return bool(file);
+}
+
+// Restore the accumulators of a summary-only run
+bool LoadState(const std::string &filename, RunInfo &info, Summary &summary)
+{
+    std::ifstream file(std::filesystem::u8path(filename),std::ios::in|std::ios::binary);
+    if(!file) return false;
+    char magic[sizeof(StateMagic)];
+    file.read(magic,sizeof(magic));
+    if(!file) return false;
+    if(!std::equal(magic,magic+sizeof(magic),StateMagic)) return false;
+    Get(file,info.N);
+    Get(file,info.Eps);
+    int64_t iters=0;
+    Get(file,iters);
+    info.Iters=long(iters);
+    Get(file,info.Seed);
+    char demographic=0;
+    Get(file,demographic);
+    info.Demographic=demographic!=0;
+    int32_t R=0;
+    Get(file,R);
+    if(!file||R<0) return false;
+    info.ids.resize(R);
+    info.names.resize(R);
+    for(int c=0;c<R;++c) {
+        GetString(file,info.ids[c]);
+        GetString(file,info.names[c]);
+    }
+    if(!file) return false;
+    return summary.Load(file)&&summary.readReported()==R;
+}
+
+// Writer for the format given by the extension of 'filename'
+ResultWriter *ResultWriter::Create(const std::string &filename)
+{
+    std::string ext=std::filesystem::u8path(filename).extension().u8string();
+    for(auto &&ch: ext) ch=char(tolower(ch));
+    if(ext==".npy") return new NpyWriter;
+    return new TsvWriter;
+}
+
+// Create the file and write the header
+bool TsvWriter::Open(const std::string &filename, const RunInfo &info)
+{
+    if(filename=="-") out=&std::cout;
+    else {
+        file.open(std::filesystem::u8path(filename),std::ios::out|std::ios::trunc);
+        if(!file) return false;
+        out=&file;
+    }
+    reported=int(info.ids.size());
+    cols=reported+1;
+    sampling=info.sampling;
+    std::vector<std::string> modes=RunModes(info);
+    int head=7+int(modes.size());
+    if(cols<head) cols=head;
+
+    // Initial population, Eps, seed and mode, then stage IDs and stage names
+    char num[32];
+    text="\tInitial\t";
+    snprintf(num,sizeof(num),"%g",double(info.N));
+    text+=num;
+    text+="\tEps\t";
+    snprintf(num,sizeof(num),"%g",double(info.Eps));
+    text+=num;
+    text+="\tSeed\t"+std::to_string(info.Seed);
+    for(auto &&m: modes) text+="\t"+m;
+    text+=std::string(cols-head,'\t')+"\n";
+    for(auto &&id: info.ids) text+="\t"+id;
+    text+=std::string(cols-1-reported,'\t')+"\n";
+    text+=info.label;
+    for(auto &&name: info.names) text+="\t"+name;
+    text+=std::string(cols-1-reported,'\t')+"\n";
+    *out<<text;
+
+    return bool(*out);
+}
+
+// Write a block of iterations
+bool TsvWriter::Write(long first, int count, const float *vals)
+{
+    if(!out) return false;
+    text.clear();
+    char num[32];
+    for(int j=0;j<count;++j) {
+        snprintf(num,sizeof(num),"%4ld",first+j+1);
+        text+=num;
+        for(int c=0;c<reported;++c) {
+            snprintf(num,sizeof(num),"\t%10.3f",double(vals[j*reported+c]));
+            text+=num;
+        }
+        text+=std::string(cols-1-reported,'\t')+"\n";
+    }
+    *out<<text;
+    return bool(*out);
+}
+
+// Write rows of statistics after the iterations
+bool TsvWriter::WriteRows(const std::vector<StatRow> &rows)
+{
+    if(!out) return false;
+    text.clear();
+    char num[32];
+    for(auto &&row: rows) {
+        text+=row.label;
+        for(double v: row.vals) {
+            snprintf(num,sizeof(num),"\t%.8g",v);
+            text+=num;
+        }
+        text+=std::string(cols-1-reported,'\t')+"\n";
+    }
+    *out<<text;
+    return bool(*out);
+}
+
+// Complete the file
+bool TsvWriter::Close()
+{
+    if(!out) return false;
+    out->flush();
+    bool ok=bool(*out);
+    if(file.is_open()) file.close();
+    out=nullptr;
+    return ok;
+}
+
+
+// Quote a string for JSON
+static std::string JsonString(const std::string &s)
+{
+    std::string q="\"";
+    for(char ch: s) {
+        if(ch=='"'||ch=='\\') {q+='\\'; q+=ch;}
+        else if((unsigned char)ch<0x20) {
+            char num[8];
+            snprintf(num,sizeof(num),"\\u%04x",ch);
+            q+=num;
+        } else q+=ch;
+    }
+    return q+"\"";
+}
+
+// Create the files, making room for all the iterations of the run
+bool NpyWriter::Open(const std::string &filename, const RunInfo &info)
+{
+    name=filename;
+    run=info;
+    reported=int(info.ids.size());
+    iters=info.Iters;
+    done=0;
+
+    // Header of the run
+    if(!WriteMeta(iters)) return false;
+
+    // Array
+    file.open(std::filesystem::u8path(filename),std::ios::in|std::ios::out|std::ios::binary|std::ios::trunc);
+    if(!file) return false;
+    if(!WriteHeader(iters)) return false;
+    // Make room for the whole array, so that every column can be written in place
+    if(iters*reported>0) {
+        file.seekp(HeaderSize+std::streamoff(iters)*reported*4-1);
+        file.put(0);
+    }
+    return bool(file);
+}
+
+// Write the header of the run to the JSON file alongside
+bool NpyWriter::WriteMeta(long rows)
+{
+    std::filesystem::path meta=std::filesystem::u8path(name).replace_extension(".json");
+    std::ofstream json(meta,std::ios::out|std::ios::trunc);
+    if(!json) return false;
+    char num[32];
+    json<<"{\n";
+    snprintf(num,sizeof(num),"%.9g",double(run.N));
+    json<<"  \"initial\": "<<num<<",\n";
+    snprintf(num,sizeof(num),"%.9g",double(run.Eps));
+    json<<"  \"eps\": "<<num<<",\n";
+    json<<"  \"iterations\": "<<rows<<",\n";
+    json<<"  \"seed\": "<<run.Seed<<",\n";
+    json<<"  \"demographic\": "<<(run.Demographic?"true":"false")<<",\n";
+    json<<"  \"sampling\": "<<JsonString(SamplingName(run.sampling))<<",\n";
+    json<<"  \"ids\": [";
+    for(int c=0;c<reported;++c) json<<(c?", ":"")<<JsonString(run.ids[c]);
+    json<<"],\n  \"names\": [";
+    for(int c=0;c<reported;++c) json<<(c?", ":"")<<JsonString(run.names[c]);
+    json<<"]\n}\n";
+    json.close();
+    return bool(json);
+}
+
+// Write the .npy header for 'rows' iterations
+bool NpyWriter::WriteHeader(long rows)
+{
+    uint16_t one=1;
+    bool little=*reinterpret_cast<unsigned char*>(&one)==1;
+    char dict[HeaderSize];
+    int n=snprintf(dict,sizeof(dict),"{'descr': '%cf4', 'fortran_order': True, 'shape': (%ld, %d), }",little?'<':'>',rows,reported);
+    if(n<0||n>HeaderSize-11) return false;
+    // Magic string, version 1.0, header length (little endian), dictionary padded with spaces up to a newline
+    std::string h("\x93NUMPY\x01\x00",8);
+    int len=HeaderSize-10;
+    h+=char(len&0xff);
+    h+=char(len>>8);
+    h+=dict;
+    h.resize(HeaderSize-1,' ');
+    h+='\n';
+    file.seekp(0);
+    file.write(h.data(),h.size());
+    return bool(file);
+}
+
+// Write a block of iterations, column by column
+bool NpyWriter::Write(long first, int count, const float *vals)
+{
+    if(!file.is_open()) return false;
+    if(first+count>iters) return false;
+    column.resize(count);
+    for(int c=0;c<reported;++c) {
+        for(int j=0;j<count;++j) column[j]=vals[j*reported+c];
+        file.seekp(HeaderSize+(std::streamoff(c)*iters+first)*4);
+        file.write(reinterpret_cast<const char*>(column.data()),std::streamsize(count)*4);
+    }
+    if(first+count>done) done=first+count;
+    return bool(file);
+}
+
+// Complete the file
+bool NpyWriter::Close()
+{
+    if(!file.is_open()) return false;
+    bool ok=bool(file);
+    if(ok&&done<iters) {
+        // Interrupted run: pack the columns and shrink the array to the iterations written
+        std::vector<float> buf(std::min<long>(done,1<<16));
+        for(int c=1;c<reported;++c) {
+            for(long j=0;j<done;j+=long(buf.size())) {
+                long n=std::min<long>(long(buf.size()),done-j);
+                file.seekg(HeaderSize+(std::streamoff(c)*iters+j)*4);
+                file.read(reinterpret_cast<char*>(buf.data()),std::streamsize(n)*4);
+                file.seekp(HeaderSize+(std::streamoff(c)*done+j)*4);
+                file.write(reinterpret_cast<const char*>(buf.data()),std::streamsize(n)*4);
+            }
+        }
+        ok=WriteHeader(done);
+        file.close();
+        // The header of the run tells the iterations actually written
+        if(!WriteMeta(done)) ok=false;
+        std::error_code ec;
+        std::filesystem::resize_file(std::filesystem::u8path(name),HeaderSize+uintmax_t(done)*reported*4,ec);
+        if(ec) ok=false;
+    } else file.close();
+    return ok&&!file.fail();
+}
@@ -0,0 +1,195 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "plan.h"
+#include "stats.h"
+#include "analytic.h"
+#include "sampling.h"
+
+// Parameters of a model run, written in the header of the results
+struct RunInfo {
+    float N;        // Initial population
+    float Eps;      // The quasi-zero value of the distribution tail
+    long Iters;     // Iterations to run
+    uint64_t Seed;  // Seed of the random generator
+    bool Demographic=false;         // Whole individuals split at random
+    Sampling sampling=Sampling::Random; // How the casters draw their rows
+    std::string label="Iter";       // Heading of the first column
+    std::vector<std::string> ids;   // Hierarchical IDs of the reported stages
+    std::vector<std::string> names; // Names of the reported stages
+
+    RunInfo(): N(0.0f), Eps(0.0f), Iters(0), Seed(0) {}
+    RunInfo(const Plan &plan, float n, float eps, long iters, uint64_t seed): N(n), Eps(eps), Iters(iters), Seed(seed) {
+        for(int c=0;c<plan.readReported();++c) {
+            ids.push_back(plan.readID(plan.readReportedStage(c)));
+            names.push_back(plan.readName(plan.readReportedStage(c)));
+        }
+    }
+};
+
+// Name of a row sampling scheme
+const char *SamplingName(Sampling s);
+
+// Modes of a run that change its results, shown after its parameters in the header
+std::vector<std::string> RunModes(const RunInfo &info);
+
+// Row of the summary statistics of a run: label, and one value per reported stage
+struct StatRow {
+    std::string label;
+    std::vector<double> vals;
+};
+
+// Label of the standard errors of a run. With stratified rows they are still those of
+// independent draws, usually well above the actual error, and are labelled so.
+std::string ErrorLabel(Sampling sampling);
+
+// Summary statistics laid out as rows: moments, then quantiles and the histogram of the
+// occupied bins (counts, unless not 'histogram') if the summary has distributions
+std::vector<StatRow> SummaryRows(const Summary &summary, bool histogram=true, Sampling sampling=Sampling::Random);
+
+// Label prefix of the rows of combination (n, eps) of a sweep
+std::string SweepLabel(float n, float eps);
+
+// Moments and quantiles of every combination of a sweep, summaries [eps x ns] as given by
+// Engine::Sweep, with labels like "N=1000 Eps=0.001 Mean"
+std::vector<StatRow> SweepRows(const std::vector<float> &ns, const std::vector<float> &eps, const std::vector<Summary> &summaries);
+
+// Moments and quantiles of every scenario of a grid, as given by Engine::Scenarios, with labels
+// like "Seeds x0.5 Mean"
+std::vector<StatRow> ScenarioRows(const std::vector<std::string> &labels, const std::vector<Summary> &summaries, Sampling sampling=Sampling::Random);
+
+// Paired comparison of variants of a model, as given by Engine::Compare, with their names:
+// the mean of every variant ("<name> Mean"), then for every variant but the first its difference
+// with the first, the SE of that difference and the SE two independent runs would have had
+std::vector<StatRow> ComparisonRows(const std::vector<Summary> &runs, const std::vector<Summary> &diffs, const std::vector<std::string> &names);
+
+// Exact mean and SD of every reported stage, as rows like those of the summary statistics
+std::vector<StatRow> ExactRows(const Analytic &exact);
+
+// Means of every reported stage corrected with control variates, their standard errors and
+// the share of the variance the controls explain, to set against the plain mean and SE
+std::vector<StatRow> ControlRows(const ControlVariates &cv, Sampling sampling=Sampling::Random);
+
+// Exact distribution of every reported stage: moments, quantiles, number of outcomes
+// and the probability of every bin of the histogram of the summary statistics
+std::vector<StatRow> DistributionRows(const ExactDistribution &exact);
+
+// Variance-based sensitivity indices of every reported stage: variance, then the first-order
+// ("S1 <casting>") and total ("ST <casting>") indices of every group, with casting names by group
+std::vector<StatRow> SobolRows(const SobolIndices &sobol, const std::vector<std::string> &names);
+
+// Write the whole exact distribution of every reported stage, one outcome per line
+bool WriteMass(const std::string &filename, const RunInfo &info, const ExactDistribution &exact);
+
+// Write the sensitivities of the mean of a stage to the casting cells, one cell per line
+// (rows and columns 1-based), with the names of the castings by plan index
+bool WriteSensitivity(const std::string &filename, const std::vector<CellSensitivity> &cells, const std::vector<std::string> &castings);
+
+// Save the accumulators of a summary-only run, to merge them later with those of other runs
+bool SaveState(const std::string &filename, const RunInfo &info, const Summary &summary);
+
+// Restore the accumulators of a summary-only run
+bool LoadState(const std::string &filename, RunInfo &info, Summary &summary);
+
+// Writes the results of a model run to disk while it is running, block after block,
+// so that the iterations never need to be all kept in memory
+class ResultWriter {
+public:
+    virtual ~ResultWriter() {}
+
+    // Writer for the format given by the extension of 'filename': .npy or tab separated text
+    static ResultWriter *Create(const std::string &filename);
+
+    // Create file 'filename' (UTF-8) and write the header
+    virtual bool Open(const std::string &filename, const RunInfo &info)=0;
+
+    // Write 'count' iterations starting at iteration 'first' (0-based)
+    virtual bool Write(long first, int count, const float *vals)=0;
+
+    // Complete the file
+    virtual bool Close()=0;
+};
+
+// Tab separated text, with the same layout as the output table of the user interface.
+// Filename "-" writes to the standard output.
+class TsvWriter : public ResultWriter {
+public:
+    bool Open(const std::string &filename, const RunInfo &info) override;
+    bool Write(long first, int count, const float *vals) override;
+    bool Close() override;
+
+    // Write the summary statistics of a run, one row per statistic
+    bool WriteSummary(const Summary &summary) {return WriteRows(SummaryRows(summary,true,sampling));}
+
+    // Write rows of statistics after the iterations
+    bool WriteRows(const std::vector<StatRow> &rows);
+
+private:
+    std::ofstream file;
+    std::ostream *out=nullptr;
+    int reported=0;
+    int cols=0;     // Columns of the output table (at least 5)
+    Sampling sampling=Sampling::Random;     // How the rows of the run were drawn
+    std::string text;   // Formatting buffer for one block
+
+};
+
+// NumPy array (.npy), [iterations x reported stages] of raw float32 in column-major
+// (Fortran) order, so that every reported stage is a contiguous column that numpy,
+// R (RcppCNpy) or a plain mmap can read without parsing. The header of the run
+// (initial population, Eps, stage IDs and names) goes to a JSON file alongside,
+// with the same name and extension .json.
+class NpyWriter : public ResultWriter {
+public:
+    bool Open(const std::string &filename, const RunInfo &info) override;
+    bool Write(long first, int count, const float *vals) override;
+    bool Close() override;
+
+    // Size of the .npy header
+    static const int HeaderSize=128;
+
+private:
+    // Write the .npy header for 'rows' iterations
+    bool WriteHeader(long rows);
+    // Write the header of the run, for 'rows' iterations, to the JSON file alongside
+    bool WriteMeta(long rows);
+
+    std::fstream file;
+    std::string name;   // File name
+    RunInfo run;        // Header of the run
+    int reported=0;
+    long iters=0;       // Iterations room has been made for
+    long done=0;        // Iterations written
+    std::vector<float> column;  // One column of a block
+
+};
+
+#endif // RESULTS_H
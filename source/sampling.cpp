@@ -0,0 +1,129 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+#include "sampling.h"
+
+#include <cmath>
+#include <algorithm>
+
+// Primitive polynomials (degree s, inner coefficients a) and initial direction numbers m of
+// dimensions 2 and up, from Joe and Kuo (new-joe-kuo-6.21201)
+struct SobolPoly {
+    int s, a;
+    uint32_t m[7];
+};
+static const SobolPoly Polys[Sequence::SobolDims-1]={
+    {1,0,{1}}, {2,1,{1,3}}, {3,1,{1,3,1}}, {3,2,{1,1,1}}, {4,1,{1,1,3,3}},
+    {4,4,{1,3,5,13}}, {5,2,{1,1,5,5,17}}, {5,4,{1,1,5,5,5}}, {5,7,{1,1,7,11,19}},
+    {5,11,{1,1,5,1,1}}, {5,13,{1,1,1,3,11}}, {5,14,{1,3,5,5,31}}, {6,1,{1,3,3,9,7,49}},
+    {6,13,{1,1,1,15,21,21}}, {6,16,{1,3,1,13,27,49}}, {6,19,{1,1,1,15,7,5}},
+    {6,22,{1,3,1,15,13,25}}, {6,25,{1,1,5,5,19,61}}, {7,1,{1,3,7,11,23,15,103}},
+    {7,4,{1,3,7,13,13,15,69}} };
+
+// Direction numbers of every dimension, built once
+struct SobolDirections {
+    uint32_t v[Sequence::SobolDims][32];
+
+    SobolDirections() {
+        for(int k=0;k<32;++k) v[0][k]=1u<<(31-k);
+        for(int d=1;d<Sequence::SobolDims;++d) {
+            const SobolPoly &p=Polys[d-1];
+            for(int k=0;k<32;++k) {
+                if(k<p.s) v[d][k]=p.m[k]<<(31-k);
+                else {
+                    uint32_t x=v[d][k-p.s]^(v[d][k-p.s]>>p.s);
+                    for(int l=1;l<p.s;++l) if((p.a>>(p.s-1-l))&1) x^=v[d][k-l];
+                    v[d][k]=x;
+                }
+            }
+        }
+    }
+};
+
+// Reverse the bits of a 32-bit word
+static uint32_t Reverse(uint32_t x)
+{
+    x=((x>>1)&0x55555555u)|((x&0x55555555u)<<1);
+    x=((x>>2)&0x33333333u)|((x&0x33333333u)<<2);
+    x=((x>>4)&0x0F0F0F0Fu)|((x&0x0F0F0F0Fu)<<4);
+    x=((x>>8)&0x00FF00FFu)|((x&0x00FF00FFu)<<8);
+    return (x>>16)|(x<<16);
+}
+
+// Nested uniform scramble: a hash in which every bit depends only on the lower ones, applied
+// to the reversed fraction, flips every digit depending only on the digits before it
+uint32_t Sequence::Scramble(uint32_t x, uint32_t key)
+{
+    x=Reverse(x);
+    x^=x*0x3D20ADEAu;
+    x+=key;
+    x*=(key>>16)|1u;
+    x^=x*0x05526C56u;
+    x^=x*0x53A22864u;
+    return Reverse(x);
+}
+
+// Scrambled Sobol point
+uint32_t Sequence::Sobol(uint64_t seed, uint64_t iter, uint64_t total, int dim)
+{
+    static const SobolDirections dirs;
+    // Past the sequence proper: a copy of another dimension would be correlated with it
+    if(dim>=SobolDims) return total>1?LatinHypercube(seed,iter,total,dim):Philox::Word(seed,iter,uint32_t(dim),0xFFFFFFFEu);
+    // Shuffle the points the same way in every dimension, to keep them joint
+    uint32_t index=Scramble(uint32_t(iter),Key(seed,-1,0));
+    uint32_t x=0;
+    for(int k=0;index;++k,index>>=1) if(index&1) x^=dirs.v[dim][k];
+    return Scramble(x,Key(seed,dim,1));
+}
+
+// Latin hypercube point
+uint32_t Sequence::LatinHypercube(uint64_t seed, uint64_t iter, uint64_t total, int dim)
+{
+    if(total<2) total=2;
+    // Stratum of the iteration: keyed Feistel permutation of the smallest even number of bits
+    // covering 'total', walking the cycle until it falls inside
+    int bits=2;
+    while(bits<64&&(uint64_t(1)<<bits)<total) bits+=2;
+    int half=bits/2;
+    uint64_t mask=(uint64_t(1)<<half)-1;
+    uint32_t k0=Key(seed,dim,2), k1=Key(seed,dim,3);
+    uint64_t x=iter%total;
+    do {
+        uint64_t l=x>>half, r=x&mask;
+        for(int round=0;round<4;++round) {
+            uint64_t h=(r^(round&1?k1:k0))*0x9E3779B97F4A7C15ull;
+            h^=h>>29;
+            h*=0xBF58476D1CE4E5B9ull;
+            h^=h>>32;
+            uint64_t n=(l^h)&mask;
+            l=r;
+            r=n;
+        }
+        x=(l<<half)|r;
+    } while(x>=total);
+    // Anywhere inside the stratum
+    double jitter=Philox::Unit(Philox::Word(seed,iter,uint32_t(dim),0xFFFFFFFFu));
+    return uint32_t(std::min(std::ldexp((double(x)+jitter)/double(total),32),4294967295.0));
+}
@@ -0,0 +1,72 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <cstdint>
+
+#include "plan.h"
+
+// How the casters draw their rows: independent random draws, or stratified sequences that
+// spread the rows drawn by every caster evenly over the iterations, which lowers the variance
+// of the estimated means for the same number of iterations
+enum class Sampling : unsigned char { Random, LatinHypercube, Sobol };
+
+// Stratified points in [0,1) as 32-bit fractions, one dimension per caster. Every point is a
+// pure function of the seed, the iteration and the dimension, so runs stay independent of
+// the number of threads.
+class Sequence {
+public:
+    // Dimensions of the Sobol sequence proper (Joe and Kuo direction numbers); the casters
+    // beyond them draw from a Latin hypercube of the 'total' iterations, or at random if unknown
+    static const int SobolDims=21;
+
+    // Scrambled Sobol point: Owen scrambling by hashing (Burley 2020), so that every power of
+    // two of consecutive iterations is stratified in every dimension
+    static uint32_t Sobol(uint64_t seed, uint64_t iter, uint64_t total, int dim);
+
+    // Latin hypercube of 'total' iterations: every dimension is split into 'total' strata,
+    // each one drawn by a single iteration given by a keyed permutation
+    static uint32_t LatinHypercube(uint64_t seed, uint64_t iter, uint64_t total, int dim);
+
+    // Row of casting t for point x, as PlanCasting::Row: the high part picks the row,
+    // the low part decides between it and its alias
+    static int Row(const PlanCasting &t, uint32_t x) {
+        uint64_t scaled=uint64_t(x)*uint32_t(t.rows);
+        int r=int(scaled>>32);
+        if(t.alias.empty()) return r;
+        return uint32_t(scaled)<t.prob[r]?r:t.alias[r];
+    }
+
+private:
+    // Random 32-bit key of 'dim' for 'purpose'
+    static uint32_t Key(uint64_t seed, int dim, uint32_t purpose) {return Philox::Word(seed,uint64_t(dim),0xFFFFFFFFu,purpose);}
+    // Nested uniform scramble of a 32-bit fraction (Owen scrambling in base 2)
+    static uint32_t Scramble(uint32_t x, uint32_t key);
+
+};
+
+#endif // SAMPLING_H
@@ -0,0 +1,225 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+#include "scenarios.h"
+#include "binomial.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <algorithm>
+
+// Split a line into words separated by blanks, words in double quotes keeping theirs
+static std::vector<std::string> Words(const std::string &line)
+{
+    std::vector<std::string> words;
+    size_t i=0;
+    while(i<line.size()) {
+        if(isspace((unsigned char)line[i])) {
+            i++;
+            continue;
+        }
+        if(line[i]=='#') break;
+        std::string w;
+        if(line[i]=='"') {
+            size_t end=line.find('"',i+1);
+            if(end==std::string::npos) end=line.size();
+            w=line.substr(i+1,end-i-1);
+            i=end+1;
+        } else {
+            while(i<line.size()&&!isspace((unsigned char)line[i])) w+=line[i++];
+        }
+        words.push_back(w);
+    }
+    return words;
+}
+
+// Read a number
+static bool Number(const std::string &w, double &v)
+{
+    char *end;
+    v=strtod(w.c_str(),&end);
+    return !w.empty()&&*end==0&&std::isfinite(v);
+}
+
+// Read the grid in a text
+bool ScenarioGrid::Parse(const std::string &text, const Plan &plan, const std::vector<std::string> &castings)
+{
+    axes.clear();
+    error.clear();
+    auto casting=[&](const std::string &name) {
+        auto found=std::find(castings.begin(),castings.end(),name);
+        return found==castings.end()?-1:int(found-castings.begin());
+    };
+    std::istringstream in(text);
+    std::string line;
+    int number=0;
+    while(std::getline(in,line)) {
+        number++;
+        std::vector<std::string> w=Words(line);
+        if(w.empty()) continue;
+        std::string where="Line "+std::to_string(number)+": ";
+        ScenarioAxis axis;
+        axis.row=axis.col=-1;
+        if(w.size()<3||(w[0]!="scale"&&w[0]!="replace")) {
+            error=where+"expected 'scale' or 'replace' and a casting.";
+            return false;
+        }
+        axis.casting=casting(w[1]);
+        if(axis.casting<0) {
+            error=where+"there is no casting '"+w[1]+"'.";
+            return false;
+        }
+        const PlanCasting &t=plan.readCasting(axis.casting);
+        if(w[0]=="scale") {
+            axis.kind=ScenarioAxis::Scale;
+            double row=0, col=0, from, to, steps;
+            if(w.size()!=7||(w[2]!="*"&&!Number(w[2],row))||(w[3]!="*"&&!Number(w[3],col))||
+               !Number(w[4],from)||!Number(w[5],to)||!Number(w[6],steps)||from<0||to<0) {
+                error=where+"expected scale <casting> <row|*> <column|*> <from> <to> <steps>, with factors not negative.";
+                return false;
+            }
+            if(steps<1||steps>MaxScenarios||steps!=std::floor(steps)) {
+                error=where+"steps must be a whole number from 1 to "+std::to_string(MaxScenarios)+".";
+                return false;
+            }
+            if((w[2]!="*"&&(row<1||row>t.rows||row!=std::floor(row)))||(w[3]!="*"&&(col<1||col>t.cols||col!=std::floor(col)))) {
+                error=where+"casting '"+w[1]+"' has no such row or column.";
+                return false;
+            }
+            if(w[2]!="*") axis.row=int(row)-1;
+            if(w[3]!="*") axis.col=int(col)-1;
+            std::string cells=axis.row<0&&axis.col<0?"":
+                              " ["+(axis.row<0?std::string("*"):std::to_string(axis.row+1))+","+(axis.col<0?std::string("*"):std::to_string(axis.col+1))+"]";
+            for(int k=0;k<int(steps);++k) {
+                float f=float(steps>1?from+(to-from)*k/(steps-1):from);
+                axis.factors.push_back(f);
+                char num[32];
+                snprintf(num,sizeof(num),"%g",double(f));
+                axis.labels.push_back(w[1]+cells+" x"+num);
+            }
+        } else {
+            axis.kind=ScenarioAxis::Replace;
+            for(size_t k=2;k<w.size();++k) {
+                int source=casting(w[k]);
+                if(source<0) {
+                    error=where+"there is no casting '"+w[k]+"'.";
+                    return false;
+                }
+                if(plan.readCasting(source).cols!=t.cols) {
+                    error=where+"casting '"+w[k]+"' has not as many columns as '"+w[1]+"'.";
+                    return false;
+                }
+                axis.sources.push_back(source);
+                axis.labels.push_back(w[1]+"="+w[k]);
+            }
+        }
+        axes.push_back(axis);
+        if(readScenarios()>MaxScenarios) {
+            error=where+"more than "+std::to_string(MaxScenarios)+" scenarios.";
+            return false;
+        }
+    }
+    if(axes.empty()) {
+        error="There are no scenarios.";
+        return false;
+    }
+
+    // Rows whose fractions share the individuals must keep doing so: scaled above 1 they would
+    // turn into offspring, which split whole individuals otherwise. The rule is that of the
+    // casters, on the cells as entered (Binomial::Sum and Binomial::Exclusive).
+    for(long s=0;s<readScenarios();++s) {
+        std::string label;
+        Plan scaled=Edit(plan,s,label,true), unscaled=Edit(plan,s,label,false);
+        for(auto &&axis: axes) {
+            if(axis.kind!=ScenarioAxis::Scale) continue;
+            const PlanCasting &t=scaled.readCasting(axis.casting), &o=unscaled.readCasting(axis.casting);
+            for(int r=0;r<t.rows;++r) {
+                double sum=Binomial::Sum(&t.cells[r*t.cols],1,t.cols), before=Binomial::Sum(&o.cells[r*t.cols],1,t.cols);
+                if(!Binomial::Exclusive(sum)&&Binomial::Exclusive(before)) {
+                    error="Scenario "+label+": row "+std::to_string(r+1)+" of casting '"+castings[axis.casting]+"' adds up to more than 1.";
+                    axes.clear();
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Read the grid in a file
+bool ScenarioGrid::Load(const std::string &filename, const Plan &plan, const std::vector<std::string> &castings)
+{
+    std::ifstream file(filename);
+    if(!file) {
+        axes.clear();
+        error="Couldn't read "+filename+".";
+        return false;
+    }
+    std::stringstream text;
+    text<<file.rdbuf();
+    return Parse(text.str(),plan,castings);
+}
+
+// Number of scenarios: every combination of the values of the axes
+long ScenarioGrid::readScenarios() const
+{
+    if(axes.empty()) return 0;
+    long n=1;
+    for(auto &&a: axes) n*=long(a.labels.size());
+    return n;
+}
+
+// Plan of a scenario
+Plan ScenarioGrid::Build(const Plan &plan, long s, std::string &label) const
+{
+    return Edit(plan,s,label,true);
+}
+
+// Plan of a scenario, with or without the scalings
+Plan ScenarioGrid::Edit(const Plan &plan, long s, std::string &label, bool scale) const
+{
+    // Value of every axis: mixed radix, the last axis changing fastest
+    std::vector<long> values(axes.size());
+    for(size_t a=axes.size();a-->0;) {
+        long n=long(axes[a].labels.size());
+        values[a]=s%n;
+        s/=n;
+    }
+    // Edits in the order of the axes
+    Plan p=plan;
+    label.clear();
+    for(size_t a=0;a<axes.size();++a) {
+        const ScenarioAxis &axis=axes[a];
+        long v=values[a];
+        if(axis.kind==ScenarioAxis::Replace) p.ReplaceCasting(axis.casting,axis.sources[v]);
+        else if(scale) p.ScaleCasting(axis.casting,axis.row,axis.col,axis.factors[v]);
+        label+=(label.empty()?"":", ")+axis.labels[v];
+    }
+    return p;
+}
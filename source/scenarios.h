@@ -0,0 +1,80 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+#ifndef SCENARIOS_H
+#define SCENARIOS_H
+
+#include <string>
+#include <vector>
+
+#include "plan.h"
+
+// One axis of a scenario grid: an edit of a casting and the values it takes
+struct ScenarioAxis {
+    enum Kind { Scale, Replace } kind;
+    int casting;            // Casting edited (plan index)
+    int row, col;           // Cells scaled, 0-based (-1: all)
+    std::vector<float> factors;     // Scale: factors of the cells
+    std::vector<int> sources;       // Replace: castings put in its place
+    std::vector<std::string> labels;    // Label of every value
+};
+
+// Grid of scenarios over edits of the castings of a model, every combination of the values of
+// its axes being a scenario. It is read from a text file, one axis per line ('#' starts a
+// comment, names with spaces go in double quotes):
+//   scale <casting> <row|*> <column|*> <from> <to> <steps>   cells times from..to in steps values
+//   replace <casting> <casting> [<casting>...]                  the casting, or a copy of another
+// Rows and columns are 1-based. Scenarios are numbered with the last axis changing fastest.
+// A grid is rejected if scaling takes a row of fractions adding up to 1 at most above 1, which
+// would turn the row into offspring (zeros stay zeros, as in Binomial::Split).
+class ScenarioGrid {
+public:
+    // Largest number of scenarios of a grid
+    static const long MaxScenarios=4096;
+
+    // Read the grid in 'text' for the castings of 'plan', named 'castings' by plan index
+    bool Parse(const std::string &text, const Plan &plan, const std::vector<std::string> &castings);
+    // Read the grid in file 'filename' (UTF-8)
+    bool Load(const std::string &filename, const Plan &plan, const std::vector<std::string> &castings);
+
+    // Description of the last error
+    const std::string &readError() const {return error;}
+
+    const std::vector<ScenarioAxis> &readAxes() const {return axes;}
+    long readScenarios() const;
+
+    // Plan of scenario s: 'plan' with its castings edited, and its label like "Seeds x0.5, Birds=Birds2"
+    Plan Build(const Plan &plan, long s, std::string &label) const;
+
+private:
+    // Plan of scenario s, with its cells scaled unless not 'scale'
+    Plan Edit(const Plan &plan, long s, std::string &label, bool scale) const;
+
+    std::vector<ScenarioAxis> axes;
+    std::string error;
+
+};
+
+#endif // SCENARIOS_H
@@ -0,0 +1,460 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+// Add 'count' values found every 'stride' floats from 'x'
+void Moments::Add(const float *x, int count, int stride)
+{
+    if(count<=0) return;
+    // Two passes over the block: mean, then squared deviations
+    Moments b;
+    double sum=0.0;
+    for(int j=0;j<count;++j) sum+=x[j*stride];
+    b.n=count;
+    b.mean=sum/count;
+    for(int j=0;j<count;++j) {
+        double v=x[j*stride];
+        double d=v-b.mean;
+        b.m2+=d*d;
+        if(v<b.min) b.min=v;
+        if(v>b.max) b.max=v;
+    }
+    Merge(b);
+}
+
+// Merge another accumulator into this one
+void Moments::Merge(const Moments &o)
+{
+    if(!o.n) return;
+    if(!n) {
+        *this=o;
+        return;
+    }
+    double N=double(n)+double(o.n);
+    double d=o.mean-mean;
+    mean+=d*double(o.n)/N;
+    m2+=o.m2+d*d*double(n)*double(o.n)/N;
+    n+=o.n;
+    if(o.min<min) min=o.min;
+    if(o.max>max) max=o.max;
+}
+
+// Raw binary values
+template<class T> static void Put(std::ostream &out, const T &v) {out.write(reinterpret_cast<const char*>(&v),sizeof(v));}
+template<class T> static void Get(std::istream &in, T &v) {in.read(reinterpret_cast<char*>(&v),sizeof(v));}
+
+// Save the accumulator
+void Moments::Save(std::ostream &out) const
+{
+    int64_t c=n;
+    Put(out,c); Put(out,mean); Put(out,m2); Put(out,min); Put(out,max);
+}
+
+// Restore the accumulator
+void Moments::Load(std::istream &in)
+{
+    int64_t c=0;
+    Get(in,c); Get(in,mean); Get(in,m2); Get(in,min); Get(in,max);
+    n=long(c);
+}
+
+// Add 'count' values to bucket i
+void QuantileSketch::AddBucket(int i, long count)
+{
+    if(buckets.empty()) {
+        offset=i;
+        buckets.assign(1,0);
+    }
+    int high=offset+int(buckets.size())-1;
+    if(i<offset) {
+        // Extend downwards, as far as the size allows: lower values fall in the lowest bucket
+        int low=std::max(i,high-MaxBuckets+1);
+        if(low<offset) {
+            buckets.insert(buckets.begin(),offset-low,0);
+            offset=low;
+        }
+        if(i<offset) i=offset;
+    } else if(i>high) {
+        // Extend upwards, collapsing the lowest buckets if needed
+        int low=std::max(offset,i-MaxBuckets+1);
+        if(low>offset) {
+            long collapsed=0;
+            int drop=std::min(low-offset,int(buckets.size()));
+            for(int b=0;b<drop;++b) collapsed+=buckets[b];
+            buckets.erase(buckets.begin(),buckets.begin()+drop);
+            offset+=drop;
+            if(buckets.empty()) {
+                offset=low;
+                buckets.assign(1,0);
+            }
+            buckets[0]+=collapsed;
+        }
+        buckets.resize(i-offset+1,0);
+    }
+    buckets[i-offset]+=count;
+}
+
+// Merge another sketch into this one
+void QuantileSketch::Merge(const QuantileSketch &o)
+{
+    // Highest buckets first, so that collapsing only ever affects the lowest ones
+    for(int b=int(o.buckets.size())-1;b>=0;--b) if(o.buckets[b]) AddBucket(o.offset+b,o.buckets[b]);
+    zeros+=o.zeros;
+    n+=o.n;
+}
+
+// Value of quantile q
+double QuantileSketch::readQuantile(double q) const
+{
+    if(!n) return 0.0;
+    if(q<0.0) q=0.0;
+    if(q>1.0) q=1.0;
+    double rank=q*double(n-1);
+    if(rank<double(zeros)) return 0.0;
+    double gamma=(1.0+Alpha)/(1.0-Alpha);
+    long seen=zeros;
+    for(int b=0;b<int(buckets.size());++b) {
+        seen+=buckets[b];
+        // Middle of bucket (gamma^(i-1), gamma^i], within relative error Alpha of any value in it
+        if(double(seen)>rank) return 2.0*std::pow(gamma,offset+b)/(gamma+1.0);
+    }
+    return 2.0*std::pow(gamma,offset+int(buckets.size())-1)/(gamma+1.0);
+}
+
+// Add a block of iterations
+void Summary::Add(int count, const float *vals)
+{
+    int R=int(stages.size());
+    for(int c=0;c<R;++c) stages[c].Add(vals+c,count,R);
+    if(distributions) for(int c=0;c<R;++c) {
+        LogHistogram &h=histograms[c];
+        QuantileSketch &q=sketches[c];
+        for(int j=0;j<count;++j) {
+            double v=vals[j*R+c];
+            h.Add(v);
+            q.Add(v);
+        }
+    }
+}
+
+// Merge the summary of other iterations
+void Summary::Merge(const Summary &o)
+{
+    if(stages.empty()) {
+        *this=o;
+        return;
+    }
+    for(int c=0;c<int(stages.size());++c) stages[c].Merge(o.stages[c]);
+    if(distributions&&o.distributions) for(int c=0;c<int(stages.size());++c) {
+        histograms[c].Merge(o.histograms[c]);
+        sketches[c].Merge(o.sketches[c]);
+    }
+}
+
+// Save the accumulators
+bool Summary::Save(std::ostream &out) const
+{
+    int32_t R=int32_t(stages.size()), D=distributions;
+    Put(out,R); Put(out,D);
+    for(auto &&m: stages) m.Save(out);
+    if(distributions) for(int c=0;c<R;++c) {
+        for(auto &&v: histograms[c].readCounts()) {int64_t x=v; Put(out,x);}
+        const QuantileSketch &q=sketches[c];
+        int32_t off=q.readOffset(), B=int32_t(q.readBuckets().size());
+        int64_t z=q.readZeros(), n=q.readCount();
+        Put(out,off); Put(out,B); Put(out,z); Put(out,n);
+        for(auto &&v: q.readBuckets()) {int64_t x=v; Put(out,x);}
+    }
+    return bool(out);
+}
+
+// Restore the accumulators
+bool Summary::Load(std::istream &in)
+{
+    int32_t R=0, D=0;
+    Get(in,R); Get(in,D);
+    if(!in||R<0) return false;
+    Init(R,D!=0);
+    for(auto &&m: stages) m.Load(in);
+    if(distributions) for(int c=0;c<R;++c) {
+        std::vector<long> counts(LogHistogram::Bins);
+        for(auto &&v: counts) {int64_t x=0; Get(in,x); v=long(x);}
+        histograms[c].Restore(counts);
+        int32_t off=0, B=0;
+        int64_t z=0, n=0;
+        Get(in,off); Get(in,B); Get(in,z); Get(in,n);
+        if(!in||B<0||B>QuantileSketch::MaxBuckets) return false;
+        std::vector<long> buckets(B);
+        for(auto &&v: buckets) {int64_t x=0; Get(in,x); v=long(x);}
+        sketches[c].Restore(off,long(z),long(n),buckets);
+    }
+    return bool(in);
+}
+
+// Target relative SE for some reported stages
+void Precision::Init(double rse, const std::vector<int> &s, int r)
+{
+    target=rse;
+    reported=r;
+    slots=s;
+    if(slots.empty()) for(int c=0;c<reported;++c) slots.push_back(c);
+    stages.assign(slots.size(),Moments());
+    count=0;
+}
+
+// Add a block of iterations
+void Precision::Add(int n, const float *vals)
+{
+    for(size_t k=0;k<slots.size();++k) stages[k].Add(vals+slots[k],n,reported);
+    count+=n;
+}
+
+// Worst relative SE of the target stages
+double Precision::readWorst() const
+{
+    double worst=0.0;
+    for(auto &&m: stages) worst=std::max(worst,RSE(m));
+    return worst;
+}
+
+double Precision::readWorst(const Summary &summary) const
+{
+    double worst=0.0;
+    for(int c: slots) worst=std::max(worst,RSE(summary.readStage(c)));
+    return worst;
+}
+
+double Precision::readWorst(const ControlVariates &cv) const
+{
+    double worst=0.0;
+    for(int c: slots) worst=std::max(worst,RSE(cv.readSE(c),cv.readMean(c)));
+    return worst;
+}
+
+// Start empty
+void ControlVariates::Init(const std::vector<std::vector<int>> &stageControls, int k)
+{
+    controls=k;
+    n=0;
+    stages.assign(stageControls.size(),Stage());
+    for(size_t c=0;c<stages.size();++c) {
+        Stage &s=stages[c];
+        s.controls=stageControls[c];
+        size_t d=s.controls.size()+1;
+        s.mean.assign(d,0.0);
+        s.m2.assign(d*d,0.0);
+    }
+}
+
+// Add a block of iterations
+void ControlVariates::Add(int count, const float *vals, const double *z)
+{
+    if(count<=0) return;
+    int R=readReported();
+    // Two passes over the block, as in Moments: means, then products of deviations
+    ControlVariates b;
+    b.controls=controls;
+    b.n=count;
+    b.stages.resize(R);
+    std::vector<double> x;
+    for(int c=0;c<R;++c) {
+        const Stage &s=stages[c];
+        Stage &t=b.stages[c];
+        size_t d=s.controls.size()+1;
+        t.mean.assign(d,0.0);
+        t.m2.assign(d*d,0.0);
+        x.resize(d);
+        for(int j=0;j<count;++j) {
+            t.mean[0]+=vals[size_t(j)*R+c];
+            for(size_t k=1;k<d;++k) t.mean[k]+=z[size_t(j)*controls+s.controls[k-1]];
+        }
+        for(size_t k=0;k<d;++k) t.mean[k]/=count;
+        for(int j=0;j<count;++j) {
+            x[0]=vals[size_t(j)*R+c]-t.mean[0];
+            for(size_t k=1;k<d;++k) x[k]=z[size_t(j)*controls+s.controls[k-1]]-t.mean[k];
+            for(size_t k=0;k<d;++k) for(size_t l=0;l<=k;++l) t.m2[k*d+l]+=x[k]*x[l];
+        }
+        for(size_t k=0;k<d;++k) for(size_t l=0;l<k;++l) t.m2[l*d+k]=t.m2[k*d+l];
+    }
+    Merge(b);
+}
+
+// Merge the estimators of other iterations
+void ControlVariates::Merge(const ControlVariates &o)
+{
+    if(!o.n) return;
+    if(!n) {
+        for(size_t c=0;c<stages.size();++c) {
+            stages[c].mean=o.stages[c].mean;
+            stages[c].m2=o.stages[c].m2;
+        }
+        n=o.n;
+        return;
+    }
+    double N=double(n)+double(o.n), w=double(n)*double(o.n)/N;
+    std::vector<double> delta;
+    for(size_t c=0;c<stages.size();++c) {
+        Stage &s=stages[c];
+        const Stage &t=o.stages[c];
+        size_t d=s.mean.size();
+        delta.resize(d);
+        for(size_t k=0;k<d;++k) {
+            delta[k]=t.mean[k]-s.mean[k];
+            s.mean[k]+=delta[k]*double(o.n)/N;
+        }
+        for(size_t k=0;k<d;++k) for(size_t l=0;l<d;++l) s.m2[k*d+l]+=t.m2[k*d+l]+delta[k]*delta[l]*w;
+    }
+    n+=o.n;
+}
+
+// Regression coefficients of a stage on its controls, by Cholesky decomposition of Szz.
+// Controls that are constant, or a combination of the previous ones, are left out.
+std::vector<double> ControlVariates::Coefficients(const Stage &s) const
+{
+    size_t d=s.mean.size(), k=d-1;
+    std::vector<double> L(k*k,0.0), b(k,0.0);
+    std::vector<char> used(k,0);
+    for(size_t i=0;i<k;++i) {
+        for(size_t j=0;j<=i;++j) {
+            if(j<i&&!used[j]) continue;
+            double v=s.m2[(i+1)*d+j+1];
+            for(size_t m=0;m<j;++m) if(used[m]) v-=L[i*k+m]*L[j*k+m];
+            if(j<i) L[i*k+j]=v/L[j*k+j];
+            else if(v>1e-12*s.m2[(i+1)*d+i+1]&&v>0.0) {
+                L[i*k+i]=std::sqrt(v);
+                used[i]=1;
+            }
+        }
+    }
+    // Solve L L' b = Szy
+    std::vector<double> y(k,0.0);
+    for(size_t i=0;i<k;++i) if(used[i]) {
+        double v=s.m2[(i+1)*d];
+        for(size_t m=0;m<i;++m) if(used[m]) v-=L[i*k+m]*y[m];
+        y[i]=v/L[i*k+i];
+    }
+    for(size_t i=k;i-->0;) if(used[i]) {
+        double v=y[i];
+        for(size_t m=i+1;m<k;++m) if(used[m]) v-=L[m*k+i]*b[m];
+        b[i]=v/L[i*k+i];
+    }
+    return b;
+}
+
+// Sum of squared residuals of the regression
+double ControlVariates::Residual(const Stage &s, const std::vector<double> &b) const
+{
+    double r=s.m2[0];
+    for(size_t k=0;k<b.size();++k) r-=b[k]*s.m2[(k+1)*s.mean.size()];
+    return std::max(r,0.0);
+}
+
+// Corrected mean of a stage: the controls have mean zero
+double ControlVariates::readMean(int c) const
+{
+    const Stage &s=stages[c];
+    std::vector<double> b=Coefficients(s);
+    double m=s.mean[0];
+    for(size_t k=0;k<b.size();++k) m-=b[k]*s.mean[k+1];
+    return m;
+}
+
+// Standard error of the corrected mean, from the residual variance
+double ControlVariates::readSE(int c) const
+{
+    const Stage &s=stages[c];
+    long dof=n-long(s.controls.size())-1;
+    if(dof<=0) return 0.0;
+    return std::sqrt(Residual(s,Coefficients(s))/double(dof)/double(n));
+}
+
+// Share of the variance explained by the controls
+double ControlVariates::readExplained(int c) const
+{
+    const Stage &s=stages[c];
+    if(!(s.m2[0]>0.0)) return 0.0;
+    return 1.0-Residual(s,Coefficients(s))/s.m2[0];
+}
+
+// Start empty
+void SobolIndices::Init(int g, int r)
+{
+    groups=g;
+    reported=r;
+    n=0;
+    outputs.assign(r,Moments());
+    first.assign(size_t(g)*r,0.0);
+    total.assign(size_t(g)*r,0.0);
+}
+
+// Add a block of iterations of every run
+void SobolIndices::Add(int count, const float *a, const float *b, const std::vector<const float*> &ab)
+{
+    for(int c=0;c<reported;++c) {
+        outputs[c].Add(a+c,count,reported);
+        outputs[c].Add(b+c,count,reported);
+    }
+    for(int g=0;g<groups;++g) for(int j=0;j<count;++j) for(int c=0;c<reported;++c) {
+        size_t k=size_t(j)*reported+c;
+        double db=double(b[k])-ab[g][k], da=double(a[k])-ab[g][k];
+        first[g*reported+c]+=db*db;
+        total[g*reported+c]+=da*da;
+    }
+    n+=count;
+}
+
+// Merge the estimators of other iterations
+void SobolIndices::Merge(const SobolIndices &o)
+{
+    if(!n&&outputs.empty()) {
+        *this=o;
+        return;
+    }
+    for(int c=0;c<reported;++c) outputs[c].Merge(o.outputs[c]);
+    for(size_t k=0;k<first.size();++k) {
+        first[k]+=o.first[k];
+        total[k]+=o.total[k];
+    }
+    n+=o.n;
+}
+
+// First-order index: V_i = V - E[(f(B)-f(AB_i))^2]/2
+double SobolIndices::readFirst(int g, int c) const
+{
+    double v=readVariance(c);
+    return n>0&&v>0.0?1.0-first[g*reported+c]/(2.0*n*v):0.0;
+}
+
+// Total index: VT_i = E[(f(A)-f(AB_i))^2]/2
+double SobolIndices::readTotal(int g, int c) const
+{
+    double v=readVariance(c);
+    return n>0&&v>0.0?total[g*reported+c]/(2.0*n*v):0.0;
+}
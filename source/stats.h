@@ -0,0 +1,336 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <iosfwd>
+
+// Streaming moments of one variable: count, mean, sum of squared deviations, min and max.
+// Blocks are added with a two-pass update and merged with the pairwise formula of
+// Chan et al., which is numerically stable and lets each thread keep its own accumulator.
+class Moments {
+public:
+    Moments() {Clear();}
+
+    void Clear() {
+        n=0;
+        mean=0.0;
+        m2=0.0;
+        min=std::numeric_limits<double>::infinity();
+        max=-std::numeric_limits<double>::infinity();
+    }
+
+    // Add one value
+    void Add(double x) {
+        n++;
+        double d=x-mean;
+        mean+=d/n;
+        m2+=d*(x-mean);
+        if(x<min) min=x;
+        if(x>max) max=x;
+    }
+
+    // Add 'count' values found every 'stride' floats from 'x'
+    void Add(const float *x, int count, int stride);
+
+    // Merge another accumulator into this one
+    void Merge(const Moments &o);
+
+    long readCount() const {return n;}
+    double readMean() const {return mean;}
+    double readVariance() const {return n>1?m2/(n-1):0.0;}
+    double readSD() const {return std::sqrt(readVariance());}
+    double readSE() const {return n>0?std::sqrt(readVariance()/n):0.0;}
+    double readMin() const {return min;}
+    double readMax() const {return max;}
+
+    // Save and restore the accumulator
+    void Save(std::ostream &out) const;
+    void Load(std::istream &in);
+
+private:
+    long n;
+    double mean, m2, min, max;
+
+};
+
+// Histogram of fixed log-spaced bins, PerDecade bins per decade from 10^MinExp to 10^MaxExp,
+// plus one bin below (including zero) and one above. The bins are the same for every
+// histogram, so histograms of different threads or runs merge by adding counts.
+class LogHistogram {
+public:
+    static const int PerDecade=10;
+    static const int MinExp=-6;
+    static const int MaxExp=12;
+    static const int Bins=(MaxExp-MinExp)*PerDecade+2;
+
+    LogHistogram() {Clear();}
+
+    void Clear() {counts.assign(Bins,0);}
+
+    // Add one value
+    void Add(double x) {counts[Bin(x)]++;}
+
+    // Merge another histogram into this one
+    void Merge(const LogHistogram &o) {for(int b=0;b<Bins;++b) counts[b]+=o.counts[b];}
+
+    // Bin of value x
+    static int Bin(double x) {
+        if(!(x>=std::pow(10.0,MinExp))) return 0;
+        int b=int(std::floor((std::log10(x)-MinExp)*PerDecade))+1;
+        return b<Bins-1?b:Bins-1;
+    }
+
+    // Lower edge of bin b (0 for the first one)
+    static double readLower(int b) {return b?std::pow(10.0,MinExp+double(b-1)/PerDecade):0.0;}
+
+    long readCount(int b) const {return counts[b];}
+
+    // Raw state, to save and restore a histogram
+    const std::vector<long> &readCounts() const {return counts;}
+    void Restore(const std::vector<long> &c) {counts=c;}
+
+private:
+    std::vector<long> counts;
+
+};
+
+// Mergeable quantile sketch with relative accuracy Alpha (DDSketch, Masson et al. 2019).
+// Positive values are counted in logarithmic buckets of ratio Gamma=(1+Alpha)/(1-Alpha);
+// beyond MaxBuckets buckets the lowest ones are collapsed, so memory stays bounded.
+class QuantileSketch {
+public:
+    static constexpr double Alpha=0.01;
+    static const int MaxBuckets=2048;
+
+    QuantileSketch() {Clear();}
+
+    void Clear() {
+        buckets.clear();
+        offset=0;
+        zeros=0;
+        n=0;
+    }
+
+    // Add one value
+    void Add(double x) {
+        if(x>0.0) AddBucket(Index(x),1);
+        else zeros++;
+        n++;
+    }
+
+    // Merge another sketch into this one
+    void Merge(const QuantileSketch &o);
+
+    // Value of quantile q (0..1)
+    double readQuantile(double q) const;
+
+    long readCount() const {return n;}
+
+    // Raw state, to save and restore a sketch
+    long readZeros() const {return zeros;}
+    int readOffset() const {return offset;}
+    const std::vector<long> &readBuckets() const {return buckets;}
+    void Restore(int off, long z, long count, const std::vector<long> &b) {
+        offset=off;
+        zeros=z;
+        n=count;
+        buckets=b;
+    }
+
+private:
+    // Bucket of a positive value
+    static int Index(double x) {return int(std::ceil(std::log(x)/std::log((1.0+Alpha)/(1.0-Alpha))));}
+    // Add 'count' values to bucket i
+    void AddBucket(int i, long count);
+
+    std::vector<long> buckets;  // Counts of buckets offset, offset+1...
+    int offset;
+    long zeros;     // Values equal to zero
+    long n;         // All values
+
+};
+
+// Summary statistics of every reported stage over a model run
+class Summary {
+public:
+    // Start empty for 'reported' stages; with 'dist' also the distribution of every stage
+    // (log histogram and quantile sketch)
+    void Init(int reported, bool dist=false) {
+        stages.assign(reported,Moments());
+        distributions=dist;
+        histograms.assign(dist?reported:0,LogHistogram());
+        sketches.assign(dist?reported:0,QuantileSketch());
+    }
+
+    // Add a block of 'count' iterations [count x reported]
+    void Add(int count, const float *vals);
+
+    // Merge the summary of other iterations
+    void Merge(const Summary &o);
+
+    int readReported() const {return int(stages.size());}
+    long readCount() const {return stages.empty()?0:stages[0].readCount();}
+    const Moments &readStage(int c) const {return stages[c];}
+    bool readDistributions() const {return distributions;}
+    const LogHistogram &readHistogram(int c) const {return histograms[c];}
+    const QuantileSketch &readSketch(int c) const {return sketches[c];}
+
+    // Save and restore the accumulators, so that runs made separately can be merged
+    bool Save(std::ostream &out) const;
+    bool Load(std::istream &in);
+
+private:
+    std::vector<Moments> stages;
+    bool distributions=false;
+    std::vector<LogHistogram> histograms;
+    std::vector<QuantileSketch> sketches;
+
+};
+
+// Control-variate estimator of the mean of every reported stage (Lavenberg & Welch 1981).
+// Controls are values of known mean zero drawn in the same iteration as the stages, every stage
+// having its own. The mean of a stage is corrected by its least squares regression on them,
+// b=Szz^-1 Szy, which removes the share of its variance they explain. Co-moments are merged
+// with the pairwise formula, as in Moments, so blocks added in order give the same estimates
+// whatever the number of threads.
+class ControlVariates {
+public:
+    // Start empty for 'controls' controls per iteration, with the indices of those of every
+    // reported stage in 'stageControls'
+    void Init(const std::vector<std::vector<int>> &stageControls, int controls);
+
+    // Add a block of 'count' iterations [count x reported], with their controls [count x controls]
+    void Add(int count, const float *vals, const double *z);
+
+    // Merge the estimators of other iterations
+    void Merge(const ControlVariates &o);
+
+    int readReported() const {return int(stages.size());}
+    long readCount() const {return n;}
+    // Corrected mean of the stage reported in column c, and its standard error
+    double readMean(int c) const;
+    double readSE(int c) const;
+    // Share of the variance of stage c explained by its controls
+    double readExplained(int c) const;
+
+private:
+    // Co-moments of a stage and its controls, the stage first
+    struct Stage {
+        std::vector<int> controls;  // Indices of the controls in an iteration
+        std::vector<double> mean;   // Means [1+controls]
+        std::vector<double> m2;     // Sums of products of deviations [(1+controls)^2]
+    };
+
+    // Regression coefficients of a stage on its controls (zero for controls that add nothing)
+    std::vector<double> Coefficients(const Stage &s) const;
+    // Sum of squared residuals of the regression
+    double Residual(const Stage &s, const std::vector<double> &b) const;
+
+    std::vector<Stage> stages;
+    int controls=0;
+    long n=0;
+
+};
+
+// Precision-driven stopping: the run goes on until the relative standard error (SE/mean)
+// of every target stage reaches 'target'. It is checked block after block in order, so a
+// given seed always stops at the same iteration. The SE is that of independent iterations:
+// runs of stratified rows (Sampling) have no target.
+class Precision {
+public:
+    // Shortest run, so that a lucky start does not stop it
+    static const long MinIters=1000;
+
+    Precision(): target(0.0), reported(0), count(0) {}
+
+    // Target relative SE (0: none) for the stages reported in columns 'slots' (empty: all of them)
+    void Init(double rse, const std::vector<int> &slots, int reported);
+    bool readActive() const {return target>0.0;}
+    double readTarget() const {return target;}
+
+    // Add a block of 'count' iterations [count x reported], for runs keeping every iteration
+    void Add(int count, const float *vals);
+
+    // Worst relative SE of the target stages, from the iterations added or from a summary
+    double readWorst() const;
+    double readWorst(const Summary &summary) const;
+    double readWorst(const ControlVariates &cv) const;
+
+    // Whether the target has been reached
+    bool Reached() const {return count>=MinIters&&readWorst()<=target;}
+    bool Reached(const Summary &summary) const {return summary.readCount()>=MinIters&&readWorst(summary)<=target;}
+    bool Reached(const ControlVariates &cv) const {return cv.readCount()>=MinIters&&readWorst(cv)<=target;}
+
+private:
+    // Relative SE of a stage; a stage that is always zero is known exactly
+    static double RSE(double se, double mean) {return se>0.0?se/std::fabs(mean):0.0;}
+    static double RSE(const Moments &m) {return RSE(m.readSE(),m.readMean());}
+
+    double target;
+    std::vector<int> slots;     // Columns of the target stages
+    std::vector<Moments> stages;
+    int reported;
+    long count;
+
+};
+
+// Streaming estimators of the variance-based (Sobol) sensitivity indices of groups of inputs,
+// from runs A and B with independent inputs and runs AB_i taking the inputs of group i from B
+// and the others from A (Saltelli et al. 2010). First-order and total indices use the squared
+// differences of Jansen (1999), which stay precise when the mean is large against the SD.
+// Blocks are added in order, so the estimates do not depend on the number of threads.
+class SobolIndices {
+public:
+    // Start empty for 'groups' groups of inputs and 'reported' stages
+    void Init(int groups, int reported);
+
+    // Add 'count' iterations [count x reported] of runs A, B and AB_i of every group
+    void Add(int count, const float *a, const float *b, const std::vector<const float*> &ab);
+
+    // Merge the estimators of other iterations
+    void Merge(const SobolIndices &o);
+
+    int readGroups() const {return groups;}
+    int readReported() const {return reported;}
+    long readCount() const {return n;}
+    // Variance of the stage reported in column c, from runs A and B
+    double readVariance(int c) const {return outputs[c].readVariance();}
+    // Share of the variance of stage c due to group g alone, and with all its interactions
+    double readFirst(int g, int c) const;
+    double readTotal(int g, int c) const;
+
+private:
+    int groups=0, reported=0;
+    long n=0;
+    std::vector<Moments> outputs;       // Stages in runs A and B
+    std::vector<double> first, total;   // Sums of squared differences [groups x reported]
+
+};
+
+#endif // STATS_H
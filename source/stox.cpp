@@ -25,11 +25,14 @@
 
 #include "stox.h"
 #include "./ui_stox.h"
+#include "sxmfile.h"
+#include "scenarios.h"
 
 #include <QMessageBox>
 #include <QDateTime>
 #include <QTextDocumentWriter>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QClipboard>
 #include <QMimeData>
 #include <QTextTable>
@@ -71,6 +74,7 @@ Stox::Stox(QWidget *parent)
     // Init global flags and variables
     NumTables=0;
     Output=nullptr;
+    Runner=nullptr;
 
     setChecked(false);  // Model not checked yet
     Saved=true;         // Model does not need saving yet
@@ -104,7 +108,7 @@ Stox::Stox(QWidget *parent)
     // Set up the casting list
     ui->CBCastings->setInsertPolicy(QComboBox::InsertAlphabetically);
 
-    // Properly seed the Mersenne Twister pseudorandom generator
+    // Properly seed the Mersenne Twister generator that picks the seeds of model runs
     generator = new std::mt19937(rand_dev()^
                                  ((std::mt19937::result_type)std::chrono::duration_cast<std::chrono::seconds>
                                   (std::chrono::system_clock::now().time_since_epoch()).count()+
@@ -117,6 +121,10 @@ Stox::Stox(QWidget *parent)
 Stox::~Stox()
 {
     // Program ends: Tidy up
+    if(Runner) {
+        Runner->Cancel();
+        Runner->wait();
+    }
     delete ui;
 
     for(auto &&t: Tables) delete t;
@@ -139,7 +147,7 @@ void Stox::setSaved(bool stat) {
 }
 
 // Add an stage to the model tree
-void Stox::AddTreeChild(QTreeWidgetItem *parent, QString name, QString cast, bool show)
+void Stox::AddTreeChild(QTreeWidgetItem *parent, QString name, QString cast, bool show, int casting)
 {
     QTreeWidgetItem *treeItem = new QTreeWidgetItem();
 
@@ -147,12 +155,40 @@ void Stox::AddTreeChild(QTreeWidgetItem *parent, QString name, QString cast, boo
     treeItem->setText(0, name);
     // Stage type / associated casting table
     treeItem->setText(1, cast);
+    if(casting>=0) treeItem->setData(1, CastingRole, casting);
     // Whether the stage is reported in the model output
     treeItem->setCheckState(2,show?Qt::Checked:Qt::Unchecked);
 
     parent->addChild(treeItem);
 }
 
+// Handle of the casting selected in the list
+int Stox::SelectedCasting() const
+{
+    return ui->CBCastings->currentIndex()<0?-1:ui->CBCastings->currentData().toInt();
+}
+
+// Assign a casting to a stage
+void Stox::setCasting(QTreeWidgetItem *stage, int handle)
+{
+    TableModel *t=readTable(handle);
+    stage->setText(1,t?t->readName():QString());
+    if(t) stage->setData(1,CastingRole,handle);
+    else stage->setData(1,CastingRole,QVariant());
+}
+
+// Set the handles of all stages from the names of their castings
+void Stox::LinkCastings()
+{
+    QHash<QString,int> handles;
+    for(int h=0;h<int(Tables.size());++h) if(Tables[h]) handles[Tables[h]->readName()]=h;
+    QTreeWidgetItemIterator it(ui->TreeWid);
+    while(*it) {
+        (*it)->setData(1,CastingRole,handles.contains((*it)->text(1))?QVariant(handles.value((*it)->text(1))):QVariant());
+        ++it;
+    }
+}
+
 
 // Create an empty casting table
 void Stox::on_BNewTable_clicked()
@@ -185,12 +221,11 @@ void Stox::on_BNewTable_clicked()
     ui->ENewCastName->clear();
 
     TableModel *dummy=new TableModel;
-    Tables.push_back(dummy);
-    NumTables++;
+    int handle=AddTable(dummy);
 
     dummy->FillZeroes(ui->SBRows->value(),ui->SBCols->value(),name);
 
-    ui->CBCastings->addItem(name);
+    ui->CBCastings->addItem(name,handle);
     ui->CBCastings->model()->sort(0);
     ind=ui->CBCastings->findText(name);
     ui->CBCastings->setCurrentIndex(ind);
@@ -234,12 +269,11 @@ void Stox::on_BDupliTable_clicked()
     ui->ENewCastName->clear();
 
     TableModel *dummy=new TableModel;
-    Tables.push_back(dummy);
-    NumTables++;
+    int handle=AddTable(dummy);
 
     dummy->FillFromCopy(static_cast<TableModel*>(ui->TableView->model()),name);
 
-    ui->CBCastings->addItem(name);
+    ui->CBCastings->addItem(name,handle);
     ui->CBCastings->model()->sort(0);
     ind=ui->CBCastings->findText(name);
     ui->CBCastings->setCurrentIndex(ind);
@@ -278,8 +312,7 @@ void Stox::on_BPasteTable_clicked()
     ui->ENewCastName->clear();
 
     TableModel *dummy=new TableModel;
-    Tables.push_back(dummy);
-    NumTables++;
+    int handle=AddTable(dummy);
 
     const QMimeData *mimeData=QApplication::clipboard()->mimeData();
     if(mimeData->hasText()) {
@@ -304,7 +337,7 @@ void Stox::on_BPasteTable_clicked()
         return;
     }
 
-    ui->CBCastings->addItem(name);
+    ui->CBCastings->addItem(name,handle);
     ui->CBCastings->model()->sort(0);
     ind=ui->CBCastings->findText(name);
     ui->CBCastings->setCurrentIndex(ind);
@@ -314,6 +347,62 @@ void Stox::on_BPasteTable_clicked()
 }
 
 
+// Merge identical rows of the current casting, weighted by their number
+void Stox::on_BCollapseTable_clicked()
+{
+    TableModel *t=readTable(SelectedCasting());
+    if(!t) {
+        ui->statusbar->showMessage("Collapse casting: There is no casting currently selected.",5000);
+        return;
+    }
+
+    int removed=t->Collapse();
+    if(!removed) {
+        ui->statusbar->showMessage("Collapse casting: Casting '"+t->readName()+"' has no identical rows.",5000);
+        return;
+    }
+    ui->SBRows->setValue(t->readRows());
+    ui->TableView->resizeColumnsToContents();
+    ui->statusbar->showMessage("Collapse casting: "+QString::number(removed)+" identical rows merged, "+QString::number(t->readRows())+" weighted rows left.",5000);
+
+    setChecked(false);
+    setSaved(false);
+}
+
+// Paste the row weights of the current casting (e.g. from MS Excel)
+void Stox::on_BPasteWeights_clicked()
+{
+    TableModel *t=readTable(SelectedCasting());
+    if(!t) {
+        ui->statusbar->showMessage("Paste weights: There is no casting currently selected.",5000);
+        return;
+    }
+
+    // Valid format: one value per line; nothing clears the weights
+    QString source=QApplication::clipboard()->text();
+    QStringList lines=source.split('\n',Qt::SkipEmptyParts);
+    std::vector<float> weights;
+    for(auto &&l: lines) {
+        bool ok;
+        float w=l.trimmed().toFloat(&ok);
+        if(!ok||w<0.0f) {
+            ui->statusbar->showMessage("Paste weights: Clipboard contents not compatible.",5000);
+            return;
+        }
+        weights.push_back(w);
+    }
+    if(!weights.empty()&&int(weights.size())!=t->readRows()) {
+        ui->statusbar->showMessage("Paste weights: Casting '"+t->readName()+"' has "+QString::number(t->readRows())+" rows but the clipboard has "+QString::number(weights.size())+" weights.",5000);
+        return;
+    }
+    t->setWeights(weights);
+    ui->statusbar->showMessage(weights.empty()?"Paste weights: All rows of casting '"+t->readName()+"' are equally likely.":"Paste weights: Weights set.",5000);
+
+    setChecked(false);
+    setSaved(false);
+}
+
+
 // Rename the current casting
 void Stox::on_BRenameTable_clicked()
 {
@@ -337,8 +426,6 @@ void Stox::on_BRenameTable_clicked()
         return;
     }
 
-    QString oldname=ui->CBCastings->itemText(ui->CBCastings->currentIndex());
-
     int ind=ui->CBCastings->findText(name);
     if(ind>=0&&ind!=ui->CBCastings->currentIndex()) {
         ui->statusbar->showMessage("Rename casting: A casting with name '"+name+"' already exists.",5000);
@@ -347,18 +434,19 @@ void Stox::on_BRenameTable_clicked()
         return;
     }
 
+    int handle=SelectedCasting();
     ui->CBCastings->setItemText(ui->CBCastings->currentIndex(),name);
     ui->CBCastings->model()->sort(0);
 
 
-    // Change name in underlying table
-    static_cast<TableModel*>(ui->TableView->model())->setName(name);
+    // Change name in underlying table: stages refer to it by handle
+    readTable(handle)->setName(name);
 
 
-    // Change name in all stages in the tree model using that casting
+    // Show the new name in all stages in the tree model using that casting
     QTreeWidgetItemIterator it(ui->TreeWid);
     while(*it) {
-        if((*it)->text(1)==oldname) (*it)->setText(1,name);
+        if(readCasting(*it)==handle) (*it)->setText(1,name);
         ++it;
     }
 
@@ -377,12 +465,13 @@ void Stox::on_BDelTable_clicked()
     }
 
     QString name=ui->CBCastings->currentText();
+    int handle=SelectedCasting();
 
     // Count how many stages used that casting
     int c=0;
     QTreeWidgetItemIterator it(ui->TreeWid);
     while(*it) {
-        if ((*it)->text(1)==name) c++;
+        if (readCasting(*it)==handle) c++;
         ++it;
     }
 
@@ -395,18 +484,16 @@ void Stox::on_BDelTable_clicked()
     box.setDefaultButton(QMessageBox::Yes);
     if(box.exec()!=QMessageBox::Yes) return;
 
-    TableModel *remTable=static_cast<TableModel*>(ui->TableView->model());
-
     ui->CBCastings->removeItem(ui->CBCastings->currentIndex());
 
-    Tables.remove(remTable);
+    Tables[handle]=nullptr;
     NumTables--;
 
     // Remove casting from all stages that had it assigned (if any)
     if(c) {
         it=QTreeWidgetItemIterator(ui->TreeWid);
         while(*it) {
-            if((*it)->text(1)==name) (*it)->setText(1,"");
+            if(readCasting(*it)==handle) setCasting(*it,-1);
             ++it;
         }
     }
@@ -420,17 +507,14 @@ void Stox::on_BDelTable_clicked()
 // Show the transition table values when a casting is selected in the list
 void Stox::on_CBCastings_currentIndexChanged(int index)
 {
-    // Locate current table from name in CBox, and show it
-    QString name=ui->CBCastings->currentText();
-    for(auto &&t: Tables) {
-        if(t->readName()==name) {
-            ui->TableView->setModel(t);
-            ui->TableView->resizeColumnsToContents();
-            if(t->readCols()<5) ui->TableView->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
-            ui->SBRows->setValue(t->readRows());
-            ui->SBCols->setValue(t->readCols());
-            return;
-        }
+    // Locate current table from its handle in CBox, and show it
+    if(TableModel *t=readTable(SelectedCasting())) {
+        ui->TableView->setModel(t);
+        ui->TableView->resizeColumnsToContents();
+        if(t->readCols()<5) ui->TableView->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+        ui->SBRows->setValue(t->readRows());
+        ui->SBCols->setValue(t->readCols());
+        return;
     }
     // No table with that name (or no tables at all)
     ui->TableView->setModel(nullptr);
@@ -450,7 +534,7 @@ void Stox::on_BChild_clicked()
         return;
     }
 
-    AddTreeChild(ui->TreeWid->currentItem(),ui->ENewNodeName->text(),NodeType==1?ui->CBCastings->currentText():TypeNames[NodeType],0);
+    AddTreeChild(ui->TreeWid->currentItem(),ui->ENewNodeName->text(),NodeType==1?ui->CBCastings->currentText():TypeNames[NodeType],0,NodeType==1?SelectedCasting():-1);
     ui->ENewNodeName->clear();
 
     setChecked(false);
@@ -477,7 +561,7 @@ void Stox::on_BSibling_clicked()
         return;
     }
 
-    AddTreeChild(item->parent(),ui->ENewNodeName->text(),NodeType==1?ui->CBCastings->currentText():TypeNames[NodeType],0);
+    AddTreeChild(item->parent(),ui->ENewNodeName->text(),NodeType==1?ui->CBCastings->currentText():TypeNames[NodeType],0,NodeType==1?SelectedCasting():-1);
     ui->ENewNodeName->clear();
 
     setChecked(false);
@@ -520,7 +604,7 @@ void Stox::on_BSetCasting_clicked()
         return;
     }
 
-    ui->TreeWid->currentItem()->setText(1,ui->CBCastings->currentText());
+    setCasting(ui->TreeWid->currentItem(),SelectedCasting());
 
     setChecked(false);
     setSaved(false);
@@ -606,9 +690,10 @@ void Stox::on_TreeWid_currentItemChanged(QTreeWidgetItem *current, QTreeWidgetIt
         return;
     }
     // If the selected stage does not have a casting assigned, we are done
-    if(current->text(1).isEmpty()||current->text(1).isNull()) return;
+    int handle=readCasting(current);
+    if(handle<0) return;
     // Else show the casting
-    int ind=ui->CBCastings->findText(current->text(1));
+    int ind=ui->CBCastings->findData(handle);
     if(ind>=0&&ind!=ui->CBCastings->currentIndex()) ui->CBCastings->setCurrentIndex(ind);
 }
 
@@ -621,7 +706,11 @@ void Stox::on_BSetType_clicked()
         return;
     }
 
-    ui->TreeWid->currentItem()->setText(1,NodeType==1?ui->CBCastings->currentText():TypeNames[NodeType]);
+    if(NodeType==1) setCasting(ui->TreeWid->currentItem(),SelectedCasting());
+    else {
+        ui->TreeWid->currentItem()->setText(1,TypeNames[NodeType]);
+        ui->TreeWid->currentItem()->setData(1,CastingRole,QVariant());
+    }
 
     setChecked(false);
     setSaved(false);
@@ -755,31 +844,40 @@ void Stox::on_actionCheck_triggered()
                 box.exec();
                 return;
             } else {
-                // Look for associated casting table
-                for(auto &&t: Tables) {
-                    if(t->readName()==Casting) {
-                        // Check if number of cols matches number of child stages
-                        if(t->readCols()!=n) {
-                            ui->TreeWid->currentItem()->setSelected(false);
-                            (*it)->setSelected(true);
-                            QMessageBox box;
-                            box.setIcon(QMessageBox::Critical);
-                            box.setText("Stage '"+(*it)->text(0)+"' ("+(*it)->text(3)+") has "+QString::number(n)+" following stages but its casting '"+Casting+"' has "+QString::number(t->readCols())+" columns.");
-                            box.exec();
-                            return;
-                        }
-                        // Found table and is OK.
-                        break;
-                    }
+                // Check if number of cols of the associated casting table matches number of child stages
+                TableModel *t=readTable(readCasting(*it));
+                if(t&&t->readCols()!=n) {
+                    ui->TreeWid->currentItem()->setSelected(false);
+                    (*it)->setSelected(true);
+                    QMessageBox box;
+                    box.setIcon(QMessageBox::Critical);
+                    box.setText("Stage '"+(*it)->text(0)+"' ("+(*it)->text(3)+") has "+QString::number(n)+" following stages but its casting '"+Casting+"' has "+QString::number(t->readCols())+" columns.");
+                    box.exec();
+                    return;
                 }
             }
         }
         ++it;
     }
 
+    // Weights of weighted castings must give every row a probability
+    for(auto &&t: Tables) {
+        if(!t||!t->readWeighted()) continue;
+        const std::vector<float> &w=t->readWeights();
+        if(std::any_of(w.begin(),w.end(),[](float x) {return !(x>=0.0f);})||std::accumulate(w.begin(),w.end(),0.0)<=0.0) {
+            ui->TableView->setModel(t);
+            QMessageBox box;
+            box.setIcon(QMessageBox::Critical);
+            box.setText("Casting '"+t->readName()+"' has negative row weights or no positive one.");
+            box.exec();
+            return;
+        }
+    }
+
     // Warn about castings with rows sums not equal to 1.0 (individuals vanish in thin air)
     int warnings=0;
     for(auto &&t: Tables) {
+        if(!t) continue;
         int rows=t->readRows();
         for(int r=0;r<rows;++r) {
             float sum=t->sumCols(r);
@@ -806,6 +904,22 @@ void Stox::on_actionCheck_triggered()
 
 }
 
+// Parse a comma separated list of positive values into 'values', which is left alone if the text is empty
+static bool ParseList(const QString &text, std::vector<float> &values)
+{
+    QStringList items=text.split(',',Qt::SkipEmptyParts);
+    if(items.isEmpty()) return true;
+    std::vector<float> list;
+    for(auto &&v: items) {
+        bool ok;
+        float f=v.trimmed().toFloat(&ok);
+        if(!ok||!(f>0.0f)) return false;
+        list.push_back(f);
+    }
+    values.swap(list);
+    return true;
+}
+
 // Run the model
 void Stox::on_actionRun_triggered()
 {
@@ -839,20 +953,116 @@ void Stox::on_actionRun_triggered()
     float N=ui->EInitial->text().toFloat();  // Inital population
     int Iters=ui->EIters->text().toInt();    // Iterations tu run
     Eps=ui->EEps->text().toFloat();          // Quasi-zero value of the tail of the probability distribution
+    double RSE=ui->ERSE->text().toDouble();  // Target relative standard error (0: run all the iterations)
+    bool demographic=ui->CBDemographic->isChecked();    // Whole individuals split at random
 
-    // Count stages to be reported
-    int cols=1;
-    QTreeWidgetItemIterator iat(ui->TreeWid);
-    while(*iat) {
-        if((*iat)->checkState(2)==Qt::Checked) cols++;
-        ++iat;
+    // Sweeps of the initial population and Eps: every combination from a single run, the first values being those of the run
+    std::vector<float> sweepN(1,N), sweepEps(1,Eps);
+    if(!ParseList(ui->ESweepN->text(),sweepN)||!ParseList(ui->ESweepEps->text(),sweepEps)) {
+        ui->statusbar->showMessage("ERROR: Sweeps must be comma separated positive values, or empty.",5000);
+        return;
+    }
+    bool sweep=sweepN.size()>1||sweepEps.size()>1||!ui->ESweepN->text().trimmed().isEmpty()||!ui->ESweepEps->text().trimmed().isEmpty();
+    bool sobol=ui->CBSobol->isChecked();     // Sensitivity indices of the castings instead of results
+    Sampling sampling=Sampling(ui->CBSampling->currentIndex());    // How the casters draw their rows, in the order of Sampling
+    if(sampling!=Sampling::Random&&(sweep||sobol)) {
+        ui->statusbar->showMessage("ERROR: Sobol indices and sweeps draw their rows at random.",5000);
+        return;
+    }
+    if(sampling!=Sampling::Random&&RSE>0.0) {
+        ui->statusbar->showMessage("ERROR: A target RSE needs random sampling: the SE of stratified rows is that of independent draws.",5000);
+        return;
+    }
+    bool control=ui->CBControl->isChecked();  // Means corrected with control variates, in summary mode
+    if(control&&(sweep||sobol)) {
+        ui->statusbar->showMessage("ERROR: Control variates are not available in sweeps or for Sobol indices.",5000);
+        return;
+    }
+    if(sweep&&sobol) {
+        ui->statusbar->showMessage("ERROR: Sobol indices are not available in sweeps.",5000);
+        return;
+    }
+    if(sweep&&demographic) {
+        ui->statusbar->showMessage("ERROR: Whole individuals are not linear in the initial population: sweeps are not available.",5000);
+        return;
+    }
+    N=sweepN[0];
+    Eps=sweepEps[0];
+
+    // Seed of the run: given to reproduce a previous run, or random
+    quint64 seed;
+    if(!ReadSeed(seed)) return;
+
+    // Compile the model tree into an execution plan
+    Plan plan;
+    if(!Compile(plan)) return;
+
+    // Stages the precision target applies to, by column: those given by ID, or every reported stage
+    std::vector<int> targets;
+    for(auto &&id: ui->ERSEStages->text().split(',',Qt::SkipEmptyParts)) {
+        int slot=0;
+        while(slot<plan.readReported()&&plan.readID(plan.readReportedStage(slot))!=id.trimmed().toStdString()) ++slot;
+        if(slot==plan.readReported()) {
+            ui->statusbar->showMessage("ERROR: Stage "+id.trimmed()+" of the target RSE is not reported.",5000);
+            return;
+        }
+        targets.push_back(slot);
+    }
+
+    // Exact moments, shown after the Monte Carlo results
+    ExactStats.clear();
+    if(ui->CBExact->isChecked()) {
+        Analytic exact;
+        for(float e: sweepEps) for(float n: sweepN) {
+            exact.Compute(plan,n,e,demographic);
+            for(auto &&row: ExactRows(exact)) {
+                if(sweep) row.label=SweepLabel(n,e)+row.label;
+                ExactStats.push_back(row);
+            }
+        }
+    }
+
+    // Exact distribution instead of iterating, when every stage has few enough outcomes
+    ExactDistribution dist;
+    bool enumerated=false;
+    if(ui->CBEnumerate->isChecked()&&(sweep||sobol)) ui->statusbar->showMessage("The exact distribution is not enumerated in sweeps or for Sobol indices: running the Monte Carlo model instead.",5000);
+    else if(ui->CBEnumerate->isChecked()&&demographic) ui->statusbar->showMessage("The exact distribution of whole individuals is not enumerated: running the Monte Carlo model instead.",5000);
+    else if(ui->CBEnumerate->isChecked()) {
+        enumerated=dist.Compute(plan,N,Eps);
+        if(!enumerated) ui->statusbar->showMessage("Some stage has more than "+QString::number(ExactDistribution::MaxOutcomes)+" outcomes: running the Monte Carlo model instead.",5000);
     }
 
+    // Stream the results to disk while running, keeping only the latest ones on screen
+    // (in summary mode there are no iteration results to stream)
+    bool summary=ui->CBSummary->isChecked()||sweep||sobol||control;
+    std::unique_ptr<ResultWriter> writer;
+    if(ui->CBStream->isChecked()&&!summary&&!enumerated) {
+        QString filename=QFileDialog::getSaveFileName(this, tr("Stream model output"),Path,tr("Text file (*.txt);; NumPy array (*.npy)"));
+        if(filename.isEmpty()) return;
+        writer.reset(ResultWriter::Create(filename.toStdString()));
+        RunInfo info(plan,N,Eps,Iters,seed);
+        info.Demographic=demographic;
+        info.sampling=sampling;
+        if(!writer->Open(filename.toStdString(),info)) {
+            ui->statusbar->showMessage("ERROR: Couldn't save model output to "+filename,5000);
+            return;
+        }
+        StreamName=filename;
+    } else StreamName.clear();
+
+    // Count stages to be reported
+    int cols=plan.readReported()+1;
+
     // Set the table for the outputs
-    if(cols<5) cols=5;
+    RunInfo modes;
+    modes.Demographic=demographic;
+    modes.sampling=sampling;
+    std::vector<std::string> flags=RunModes(modes);
+    if(cols<7+int(flags.size())) cols=7+int(flags.size());
     if(Output) delete Output;
     Output=new OutTableModel;
-    Output->Init(Iters+3,cols);
+    Output->Init(3,cols,plan.readReported());
+    if(writer) Output->setWindow(OutTableModel::StreamWindow);
     ui->TVOutput->setModel(Output);
 
     // Build the header
@@ -860,7 +1070,10 @@ void Stox::on_actionRun_triggered()
     Output->setCell(0,2,QString::number(N));
     Output->setCell(0,3,"Eps");
     Output->setCell(0,4,QString::number(Eps));
-    Output->setCell(2,0,"Iter");
+    Output->setCell(0,5,"Seed");
+    Output->setCell(0,6,QString::number(seed));
+    for(int f=0;f<int(flags.size());++f) Output->setCell(0,7+f,QString::fromStdString(flags[f]));
+    Output->setCell(2,0,sobol?"Index":summary||enumerated?"Stat":"Iter");
     cols=1;
     QTreeWidgetItemIterator it(ui->TreeWid);
     while(*it) {
@@ -873,78 +1086,329 @@ void Stox::on_actionRun_triggered()
     }
     ui->TVOutput->resizeColumnsToContents();
 
+    // The distribution is already known
+    if(enumerated) {
+        ShowStats(DistributionRows(dist));
+        if(!ExactStats.empty()) ShowStats(ExactStats);
+        ui->statusbar->showMessage("Exact distribution computed: up to "+QString::number(dist.readMaxOutcomes())+" outcomes per stage.",5000);
+        return;
+    }
 
-    // Iterate
+    // Iterate in the background, in blocks spread over all the cores
     ui->BCancel->show();  // Show the cancel button to allow the user to interrupt a long run
-    GoOn=true;
-    for(int i=1;i<=Iters&&GoOn;++i) {
-        // Output iteration number
-        Output->setCell(i+2,0,QString("%1").arg(i,4));
-
-        // Trig the casting at the top of the model tree
-        Cast(*ui->TreeWid->topLevelItem(0),N);
-
-        // Output iteration results
-        QTreeWidgetItemIterator itt(ui->TreeWid);
-        cols=1;
-        while(*itt) {
-            if((*itt)->checkState(2)==Qt::Checked) {
-                Output->setCell(i+2,cols,QString("%1").arg((*itt)->data(0,Qt::UserRole).toFloat(),10,'f',3));
-                ++cols;
-            }
-            ++itt;
+    ui->actionRun->setEnabled(false);
+    Precision precision;
+    if(RSE>0.0&&!sweep&&!sobol) precision.Init(RSE,targets,plan.readReported());
+    Runner=new RunThread(std::move(plan),N,Eps,seed,demographic,Iters,writer.release(),summary,precision,this);
+    if(sweep) Runner->setSweep(sweepN,sweepEps);
+    Runner->setSobol(sobol);
+    Runner->setSampling(sampling);
+    Runner->setControl(control);
+    // Castings are compiled in the order of their handles
+    CastingNames.clear();
+    for(auto &&t: Tables) if(t) CastingNames.push_back(t->readName().toStdString());
+    connect(Runner,&RunThread::progress,this,&Stox::RunProgress);
+    connect(Runner,&QThread::finished,this,&Stox::RunFinished);
+    Runner->start();
+
+}
+
+// Seed of a run: given to reproduce a previous run, or random
+bool Stox::ReadSeed(quint64 &seed)
+{
+    if(ui->ESeed->text().trimmed().isEmpty()) seed=(quint64((*generator)())<<32)|(*generator)();
+    else {
+        bool ok;
+        seed=ui->ESeed->text().trimmed().toULongLong(&ok);
+        if(!ok) {
+            ui->statusbar->showMessage("ERROR: The seed must be a non-negative integer, or empty for a random one.",5000);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Compare the model with variants saved to disk, with common random numbers
+void Stox::on_actionCompare_triggered()
+{
+    if(Runner) return;
+    if(!Checked) on_actionCheck_triggered();
+    if(!Checked) {
+        ui->statusbar->showMessage("Cannot compare a model not validated by checking.",5000);
+        return;
+    }
+    QStringList files=QFileDialog::getOpenFileNames(this, tr("Compare with models"),Path,tr("StoX model file (*.sxm)"));
+    if(files.isEmpty()) return;
+
+    // The model as it stands, then the variants
+    Plan plan;
+    if(!Compile(plan)) return;
+    std::vector<Plan> variants;
+    std::vector<std::string> names(1,FileName.isEmpty()?"Model":QFileInfo(FileName).completeBaseName().toStdString());
+    for(auto &&file: files) {
+        SxmFile model;
+        variants.emplace_back();
+        if(!model.Load(file)||!model.Compile(variants.back())) {
+            ui->statusbar->showMessage("ERROR: "+QFileInfo(file).fileName()+": "+model.readError(),5000);
+            return;
         }
-        Output->updateRow(i+2);
+        names.push_back(QFileInfo(file).completeBaseName().toStdString());
+    }
+
+    float N=ui->EInitial->text().toFloat();
+    int Iters=ui->EIters->text().toInt();
+    Eps=ui->EEps->text().toFloat();
+    bool demographic=ui->CBDemographic->isChecked();
+    quint64 seed;
+    if(!ReadSeed(seed)) return;
+
+    RunInfo info(plan,N,Eps,Iters,seed);
+    info.Demographic=demographic;
+    ShowHeader(info);
+    Runner=new RunThread(std::move(plan),N,Eps,seed,demographic,Iters,nullptr,true,Precision(),this);
+    Runner->setCompare(std::move(variants),names);
+    StartRun();
+}
+
+// Run every scenario of a grid of edits of the castings, read from a file
+void Stox::on_actionScenarios_triggered()
+{
+    if(Runner) return;
+    if(!Checked) on_actionCheck_triggered();
+    if(!Checked) {
+        ui->statusbar->showMessage("Cannot run scenarios of a model not validated by checking.",5000);
+        return;
+    }
+    QString filename=QFileDialog::getOpenFileName(this, tr("Run scenarios"),Path,tr("Scenario grid (*.txt);; All files (*)"));
+    if(filename.isEmpty()) return;
+
+    Plan plan;
+    if(!Compile(plan)) return;
+    // Castings are compiled in the order of their handles
+    std::vector<std::string> castings;
+    for(auto &&t: Tables) if(t) castings.push_back(t->readName().toStdString());
+    ScenarioGrid grid;
+    if(!grid.Load(filename.toStdString(),plan,castings)) {
+        ui->statusbar->showMessage("ERROR: "+QFileInfo(filename).fileName()+": "+QString::fromStdString(grid.readError()),5000);
+        return;
+    }
+    std::vector<Plan> plans;
+    std::vector<std::string> labels(grid.readScenarios());
+    for(long s=0;s<grid.readScenarios();++s) plans.push_back(grid.Build(plan,s,labels[s]));
+
+    float N=ui->EInitial->text().toFloat();
+    int Iters=ui->EIters->text().toInt();
+    Eps=ui->EEps->text().toFloat();
+    bool demographic=ui->CBDemographic->isChecked();
+    Sampling sampling=Sampling(ui->CBSampling->currentIndex());
+    quint64 seed;
+    if(!ReadSeed(seed)) return;
+
+    RunInfo info(plan,N,Eps,Iters,seed);
+    info.Demographic=demographic;
+    info.sampling=sampling;
+    ShowHeader(info);
+    Runner=new RunThread(std::move(plan),N,Eps,seed,demographic,Iters,nullptr,true,Precision(),this);
+    Runner->setSampling(sampling);
+    Runner->setScenarios(std::move(plans),labels);
+    StartRun();
+}
+
+// Set the output table for the rows of statistics of a run
+void Stox::ShowHeader(const RunInfo &info)
+{
+    if(ui->tabWidget->currentIndex()==0) ui->tabWidget->setCurrentIndex(1);
+    std::vector<std::string> flags=RunModes(info);
+    int R=int(info.ids.size());
+    int cols=std::max(R+1,7+int(flags.size()));
+    if(Output) delete Output;
+    Output=new OutTableModel;
+    Output->Init(3,cols,R);
+    ui->TVOutput->setModel(Output);
+    Output->setCell(0,1,"Initial");
+    Output->setCell(0,2,QString::number(info.N));
+    Output->setCell(0,3,"Eps");
+    Output->setCell(0,4,QString::number(info.Eps));
+    Output->setCell(0,5,"Seed");
+    Output->setCell(0,6,QString::number(info.Seed));
+    for(int f=0;f<int(flags.size());++f) Output->setCell(0,7+f,QString::fromStdString(flags[f]));
+    Output->setCell(2,0,"Stat");
+    for(int c=0;c<R;++c) {
+        Output->setCell(1,c+1,QString::fromStdString(info.ids[c]));
+        Output->setCell(2,c+1,QString::fromStdString(info.names[c]));
+    }
+    ui->TVOutput->resizeColumnsToContents();
+}
+
+// Start the background run set up in Runner, which keeps only statistics
+void Stox::StartRun()
+{
+    ExactStats.clear();
+    StreamName.clear();
+    ui->BCancel->show();
+    ui->actionRun->setEnabled(false);
+    connect(Runner,&RunThread::progress,this,&Stox::RunProgress);
+    connect(Runner,&QThread::finished,this,&Stox::RunFinished);
+    Runner->start();
+}
+
+// Sensitivity of the mean of the selected stage to the casting cells
+void Stox::on_actionSensitivity_triggered()
+{
+    if(Runner) return;
+    QTreeWidgetItem *item=ui->TreeWid->currentItem();
+    if(!item) {
+        ui->statusbar->showMessage("Sensitivity: There is no stage currently selected.",5000);
+        return;
+    }
+    if(!Checked) on_actionCheck_triggered();
+    if(!Checked) {
+        ui->statusbar->showMessage("Cannot analyse a model not validated by checking.",5000);
+        return;
+    }
+
+    Plan plan;
+    if(!Compile(plan)) return;
+    // Stages are compiled in preorder
+    int stage=0;
+    for(QTreeWidgetItemIterator it(ui->TreeWid);*it&&*it!=item;++it) stage++;
+    float N=ui->EInitial->text().toFloat();
+    Eps=ui->EEps->text().toFloat();
+    Analytic exact;
+    exact.Compute(plan,N,Eps,ui->CBDemographic->isChecked());
+    std::vector<CellSensitivity> cells=exact.Sensitivities(stage);
+    // Castings are compiled in the order of their handles
+    std::vector<QString> names;
+    for(auto &&t: Tables) if(t) names.push_back(t->readName());
+
+    if(ui->tabWidget->currentIndex()==0) ui->tabWidget->setCurrentIndex(1);
+    if(Output) delete Output;
+    Output=new OutTableModel;
+    Output->Init(3,7,0);
+    ui->TVOutput->setModel(Output);
+    Output->setCell(0,0,"Stage");
+    Output->setCell(0,1,item->text(3));
+    Output->setCell(0,2,item->text(0));
+    Output->setCell(0,3,"Mean");
+    Output->setCell(0,4,QString::number(exact.readStageMean(stage),'g',8));
+    Output->setCell(0,5,"Initial");
+    Output->setCell(0,6,QString::number(N));
+    const char *headings[]={"Casting","Row","Column","Value","Derivative","Constrained","Elasticity"};
+    for(int c=0;c<7;++c) Output->setCell(2,c,headings[c]);
+    for(auto &&s: cells) Output->AppendFooter({names[s.casting],QString::number(s.row+1),QString::number(s.col+1),QString::number(s.value),
+                                               QString::number(s.derivative,'g',6),QString::number(s.constrained,'g',6),QString::number(s.elasticity,'g',6)});
+    ui->TVOutput->resizeColumnsToContents();
+    ui->statusbar->showMessage("Sensitivity of stage '"+item->text(0)+"' to "+QString::number(cells.size())+" casting cells.",5000);
+}
 
-        // Keep an eye on any user input
-        QApplication::processEvents();
+// Show the results produced by the background run since the last update
+void Stox::RunProgress(qint64 done)
+{
+    if(!Runner) return;
+    std::vector<float> vals;
+    int count;
+    qint64 first=Runner->Take(vals,count);
+    Output->AppendRows(first,count,vals.data());
+    ui->statusbar->showMessage("Running: "+QString::number(done)+" iterations.");
+}
 
+// The background run is over
+void Stox::RunFinished()
+{
+    RunProgress(0);
+    if(Runner->readScenarios()) ShowStats(ScenarioRows(Runner->readScenarioLabels(),Runner->readScenarioSummaries(),Runner->readSampling()));
+    else if(Runner->readCompare()) ShowStats(ComparisonRows(Runner->readComparisonRuns(),Runner->readComparisonDiffs(),Runner->readComparisonNames()));
+    else if(Runner->readSobol()) {
+        std::vector<std::string> names;
+        for(int g: Runner->readSobolGroups()) names.push_back(CastingNames[g]);
+        ShowStats(SobolRows(Runner->readSobolIndices(),names));
+    } else if(Runner->readSweep()) ShowStats(SweepRows(Runner->readSweepN(),Runner->readSweepEps(),Runner->readSweepSummaries()));
+    else if(Runner->readSummaryOnly()) {
+        ShowSummary(Runner->readSummary(),Runner->readSampling());
+        if(Runner->readControl()) ShowStats(ControlRows(Runner->readControlVariates(),Runner->readSampling()));
     }
+    if(!ExactStats.empty()) ShowStats(ExactStats);
+    bool writeError=Runner->readWriteError();
+    QString precision;
+    if(Runner->readPrecision().readActive()) {
+        double worst=Runner->readWorstRSE();
+        precision=QString(worst<=Runner->readPrecision().readTarget()?" Target precision reached":" Target precision not reached")
+                +" after "+QString::number(Runner->readDone())+" iterations (worst relative SE "+QString::number(worst,'g',3)+").";
+    }
+    Runner->deleteLater();
+    Runner=nullptr;
 
     // We are done
     ui->BCancel->hide();
+    ui->actionRun->setEnabled(true);
 
-    ui->statusbar->showMessage("Model successfully ran.",5000);
+    if(writeError) ui->statusbar->showMessage("ERROR: Couldn't save model output to "+StreamName,5000);
+    else if(!StreamName.isEmpty()) ui->statusbar->showMessage("Model successfully ran."+precision+" Model output saved to "+StreamName,5000);
+    else ui->statusbar->showMessage("Model successfully ran."+precision,5000);
 
 }
 
-// Process stage in model run
-void Stox::Cast(QTreeWidgetItem &node, float n) {
-    // Receive population
-    node.setData(0,Qt::UserRole,n);
-    // Terminal stage: all ends here
-    if(node.text(1)=="Success"||node.text(1)=="Sink") return;
-    // Direct transit stage: pass the whole lot
-    if(node.text(1)=="Direct") {
-        Cast(*node.child(0),n);
-        return;
+// Add rows of statistics to the output table
+void Stox::ShowStats(const std::vector<StatRow> &stats)
+{
+    for(auto &&stat: stats) {
+        std::vector<QString> row(1,QString::fromStdString(stat.label));
+        for(double v: stat.vals) row.push_back(QString::number(v,'g',8));
+        Output->AppendFooter(row);
     }
-    // Caster stage: Cast population to following stages
-    const QString &Casting=node.text(1);
-    for(auto &&t: Tables) {
-        // Locate casting table
-        if(t->readName()==Casting) {
-            int r=t->readRows();
-            if(r>1) {
-                // Bootstrap
-                std::uniform_int_distribution<int> distr(0,r-1);
-                r=distr(*generator);
-            }
-            // Distribute the lot
-            for(int c=0;c<node.childCount();++c) {
-                float f=t->readCell(r,c);
-                Cast(*node.child(c),n*(f>0.0?f:Eps));
+    ui->TVOutput->resizeColumnsToContents();
+}
+
+// Compile the model tree into a flat execution plan
+bool Stox::Compile(Plan &plan)
+{
+    plan.Clear();
+
+    // Copy the castings once, so that stages refer to them by index
+    std::vector<int> castings(Tables.size(),-1);
+    for(int h=0;h<int(Tables.size());++h) if(TableModel *t=Tables[h]) {
+        int rows=t->readRows(), cols=t->readCols();
+        std::vector<float> raw(rows*cols);
+        for(int r=0;r<rows;++r) for(int c=0;c<cols;++c) raw[r*cols+c]=t->readCell(r,c);
+        castings[h]=plan.AddCasting(rows,cols,raw.data(),t->readWeighted()?t->readWeights().data():nullptr);
+    }
+
+    // Add the stages in preorder
+    QHash<QTreeWidgetItem*,int> index;
+    QTreeWidgetItemIterator it(ui->TreeWid);
+    while(*it) {
+        const QString &Casting=(*it)->text(1);
+        StageKind kind=StageKind::Caster;
+        int cast=-1;
+        if(Casting=="Direct") kind=StageKind::Direct;
+        else if(Casting=="Success") kind=StageKind::Success;
+        else if(Casting=="Sink") kind=StageKind::Sink;
+        else {
+            int handle=readCasting(*it);
+            if(!readTable(handle)) {
+                QMessageBox box;
+                box.setIcon(QMessageBox::Critical);
+                box.setText("Stage '"+(*it)->text(0)+"' ("+(*it)->text(3)+") uses casting '"+Casting+"', which does not exist.");
+                box.exec();
+                return false;
             }
-            break;
+            cast=castings[handle];
         }
+        QTreeWidgetItem *parent=(*it)->parent();
+        index[*it]=plan.AddStage(parent?index.value(parent):-1,kind,cast,(*it)->checkState(2)==Qt::Checked,
+                                 (*it)->text(0).toStdString(),(*it)->text(3).toStdString());
+        ++it;
     }
+    plan.Finish();
+
+    return true;
 }
 
 
 // Abort model run
 void Stox::on_BCancel_clicked()
 {
-    GoOn=false;
+    if(Runner) Runner->Cancel();
 }
 
 
@@ -1015,14 +1479,20 @@ void Stox::on_actionSave_triggered()
             stream<<*(i.getItem());
         }
         // Save the castings
-        int n=Tables.size();
-        stream<<n;
+        stream<<NumTables;
         for(auto &&t: Tables) {
+            if(!t) continue;
             stream<<t->readName();
             int rows=t->readRows(), cols=t->readCols();
             stream<<rows<<cols;
             for(int r=0;r<rows;++r) for(int c=0;c<cols;++c) stream<<t->readCell(r,c);
         }
+        // Save the row weights after the castings, where earlier versions stop reading
+        for(auto &&t: Tables) {
+            if(!t) continue;
+            stream<<int(t->readWeights().size());
+            for(float w: t->readWeights()) stream<<w;
+        }
         file.close();
         setSaved(true);
         ui->statusbar->showMessage("Save model: Model saved to "+FileName,5000);
@@ -1080,11 +1550,9 @@ void Stox::on_actionOpen_triggered()
         Tables.clear();
         stream>>NumTables;
         Tables.resize(NumTables);
-        QStringList tablenames;
         for(auto &&t: Tables) {
             QString name;
             stream>>name;
-            tablenames<<name;
             t=new TableModel;
             t->setName(name);
             int rows, cols;
@@ -1094,6 +1562,15 @@ void Stox::on_actionOpen_triggered()
             t->FillFromRaw(raw,rows,cols);
             delete [] raw;
         }
+        // Read the row weights (none in models saved by earlier versions)
+        for(auto &&t: Tables) {
+            if(stream.atEnd()) break;
+            int n;
+            stream>>n;
+            std::vector<float> weights(n);
+            for(auto &&w: weights) stream>>w;
+            if(n==t->readRows()) t->setWeights(weights);
+        }
 
         file.close();
         FileName=filename;
@@ -1115,8 +1592,11 @@ void Stox::on_actionOpen_triggered()
             }
         }
 
+        // Link the stages to their castings
+        LinkCastings();
+
         // Fill the list of castings and sort by name
-        ui->CBCastings->addItems(tablenames);
+        for(int h=0;h<NumTables;++h) ui->CBCastings->addItem(Tables[h]->readName(),h);
         ui->CBCastings->model()->sort(0);
 
         // Expand the full model tree
@@ -1154,7 +1634,7 @@ void Stox::on_actionNew_triggered()
     ui->TreeWid->addTopLevelItem(new QTreeWidgetItem(static_cast<QTreeWidget *>(nullptr), QStringList() << "Start"));
 
     // Empty castings list
-    if(!Tables.empty()) for(auto &&t: Tables) delete t;
+    for(auto &&t: Tables) delete t;
     Tables.clear();
     NumTables=0;
     ui->CBCastings->clear();
@@ -31,7 +31,19 @@
 #include <QTreeWidget>
 #include <QLabel>
 #include <QCloseEvent>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
 #include <random>
+#include <memory>
+#include <map>
+#include <algorithm>
+#include <numeric>
+
+#include "plan.h"
+#include "engine.h"
+#include "results.h"
 
 //#include <qDebug>
 
@@ -61,6 +73,7 @@ public:
         rawdata.clear();
         rawdata.resize(rows,std::vector<float>(cols, 0));
         for(auto&& r:rawdata) for(int c=0;c<cols;++c) r[c]=*raw++;
+        weights.clear();
 
         endResetModel();
     };
@@ -75,6 +88,7 @@ public:
         rawdata.clear();
         rawdata.resize(myrows,std::vector<float>(mycols, 0));
         for(int r=0;r<myrows;++r) for(int c=0;c<mycols;++c) rawdata[r][c]=source->readCell(r,c);
+        weights=source->weights;
 
         endResetModel();
     };
@@ -89,6 +103,7 @@ public:
         rawdata.clear();
         rawdata.resize(rows,std::vector<float>(cols, 0));
         //for(auto&& r:rawdata) for(int c=0;c<cols;++c) r[c]=0;
+        weights.clear();
 
         endResetModel();
     };
@@ -129,6 +144,44 @@ public:
         rawdata.at(r).at(c)=v;
     }
 
+    // Row weights for bootstrapping (empty: all rows equally likely)
+    bool readWeighted() const {return !weights.empty();}
+    float readWeight(int r) const {return weights.empty()?1.0f:weights.at(r);}
+    const std::vector<float> &readWeights() const {return weights;}
+    void setWeights(const std::vector<float> &w) {
+        weights=w;
+        emit headerDataChanged(Qt::Vertical,0,myrows-1);
+    }
+
+    // Merge identical rows into one, adding up their weights. Returns the rows removed.
+    int Collapse() {
+        std::map<std::vector<float>,int> seen;
+        std::vector<std::vector<float>> rows;
+        std::vector<float> w;
+        for(int r=0;r<myrows;++r) {
+            auto found=seen.emplace(rawdata[r],int(rows.size()));
+            if(found.second) {
+                rows.push_back(rawdata[r]);
+                w.push_back(readWeight(r));
+            } else w[found.first->second]+=readWeight(r);
+        }
+        int removed=myrows-int(rows.size());
+        if(!removed) return 0;
+        beginResetModel();
+        rawdata.swap(rows);
+        weights.swap(w);
+        myrows=int(rawdata.size());
+        endResetModel();
+        return removed;
+    }
+
+    // Row headers show the weights of weighted castings
+    QVariant headerData(int section, Qt::Orientation orientation, int role) const override {
+        if(orientation==Qt::Vertical&&role==Qt::DisplayRole&&!weights.empty()&&section<int(weights.size()))
+            return QString::number(section+1)+" (w "+QString::number(weights[section])+")";
+        return QAbstractTableModel::headerData(section,orientation,role);
+    }
+
     // Read table data for Table View widget
     QVariant data(const QModelIndex &index, int role) const override {
         if(!index.isValid()) return QVariant();
@@ -184,6 +237,8 @@ private:
     int myrows, mycols;
     // Casting name
     QString name;
+    // Row weights (empty: all equal)
+    std::vector<float> weights;
 
 };
 
@@ -202,31 +257,89 @@ public:
 };
 
 
-// Output table
+// Output table: a few header rows of text, followed by one row of numbers per iteration.
+// The results are kept as floats in a contiguous buffer and only formatted when the view
+// asks for a cell, so the run loop never formats text and a million rows scroll instantly.
 class OutTableModel : public QAbstractTableModel
 {
     Q_OBJECT
 public:
+    // Rows kept when the results are streamed to disk
+    static const int StreamWindow=10000;
+
     // Always created empty
     explicit OutTableModel(QObject *parent = 0): QAbstractTableModel(parent) {
-        myrows=0;
         mycols=0;
+        reported=0;
+        numrows=0;
+        start=0;
+        window=0;
+        firstiter=0;
     }
 
-    // Init table with given size
-    void Init(int rows, int cols) {
+    // Init table with 'rows' header rows, 'cols' columns, and room for 'rep' reported stages per iteration
+    void Init(int rows, int cols, int rep) {
         beginResetModel();
 
-        myrows=rows;
         mycols=cols;
-        rawdata.clear();
-        rawdata.resize(rows,std::vector<QString>(cols,""));
+        reported=rep;
+        header.clear();
+        header.resize(rows,std::vector<QString>(cols,""));
+        values.clear();
+        footer.clear();
+        numrows=0;
+        start=0;
+        firstiter=0;
 
         endResetModel();
     }
 
+    // Keep only the last 'w' iterations appended (0: keep them all)
+    void setWindow(int w) {window=w;}
+
+    // Add a row of text after the iterations (e.g. summary statistics)
+    void AppendFooter(const std::vector<QString> &row) {
+        int r=readRows();
+        beginInsertRows(QModelIndex(),r,r);
+        footer.push_back(row);
+        footer.back().resize(mycols);
+        endInsertRows();
+    }
+
+    // Add 'count' iterations after the last one, the first one being iteration 'first' (0-based),
+    // dropping the oldest ones beyond the window
+    void AppendRows(qint64 first, int count, const float *vals) {
+        if(count<=0) return;
+        if(window>0&&count>window) {
+            vals+=size_t(count-window)*reported;
+            first+=count-window;
+            count=window;
+        }
+        int H=int(header.size());
+        if(window>0) {
+            // Ring buffer of 'window' rows
+            int drop=numrows+count-window;
+            if(drop>0) {
+                beginRemoveRows(QModelIndex(),H,H+drop-1);
+                start=(start+drop)%window;
+                numrows-=drop;
+                firstiter+=drop;
+                endRemoveRows();
+            }
+            beginInsertRows(QModelIndex(),H+numrows,H+numrows+count-1);
+            values.resize(size_t(window)*reported);
+            for(int j=0;j<count;++j) std::copy(vals+size_t(j)*reported,vals+size_t(j+1)*reported,values.data()+size_t((start+numrows+j)%window)*reported);
+        } else {
+            beginInsertRows(QModelIndex(),H+numrows,H+numrows+count-1);
+            values.insert(values.end(),vals,vals+size_t(count)*reported);
+        }
+        if(!numrows) firstiter=first;
+        numrows+=count;
+        endInsertRows();
+    }
+
     // Read number of columns for Table View widget
-    int rowCount(const QModelIndex &parent) const override {return parent.isValid()?0:myrows;}
+    int rowCount(const QModelIndex &parent) const override {return parent.isValid()?0:readRows();}
 
     // Read number of rows for Table View widget
     int columnCount(const QModelIndex &parent) const override {return parent.isValid()?0:mycols;}
@@ -235,22 +348,38 @@ public:
     int readCols() const {return mycols;}
 
     // Read number of rows simple
-    int readRows() const {return myrows;}
+    int readRows() const {return int(header.size())+numrows+int(footer.size());}
 
     // Read value in (row r,col c)
-    QString readCell(int r, int c) {return rawdata.at(r).at(c);}
+    QString readCell(int r, int c) const {
+        int H=int(header.size());
+        if(r<H) return header.at(r).at(c);
+        r-=H;
+        if(r>=numrows) return footer.at(r-numrows).at(c);
+        // Iteration number
+        if(c==0) return QString("%1").arg(firstiter+r+1,4);
+        // Iteration results
+        if(c<=reported) return QString("%1").arg(readValue(r,c-1),10,'f',3);
+        return "";
+    }
 
-    // Set table value at (row r,col c)
-    void setCell(int r, int c, QString v) {rawdata.at(r).at(c)=v;}
+    // Read result of stage column c (0-based) for the r-th iteration kept
+    float readValue(int r, int c) const {
+        size_t row=window>0?size_t((start+r)%window):size_t(r);
+        return values[row*reported+c];
+    }
+
+    // Set header value at (row r,col c)
+    void setCell(int r, int c, QString v) {header.at(r).at(c)=v;}
 
     void updateRow(int r) {emit dataChanged(this->index(r,0),this->index(r,mycols-1), {Qt::DisplayRole});}
 
     // Read table data for Table View widget
     QVariant data(const QModelIndex &index, int role) const override {
         if(!index.isValid()) return QVariant();
-        if(index.row()>=myrows || index.row()<0) return QVariant();
-        if(role==Qt::TextAlignmentRole) return index.row()<3?int(Qt::AlignCenter | Qt::AlignVCenter):int(Qt::AlignRight | Qt::AlignVCenter);
-        if(role==Qt::DisplayRole) return rawdata.at(index.row()).at(index.column());
+        if(index.row()>=readRows() || index.row()<0) return QVariant();
+        if(role==Qt::TextAlignmentRole) return index.row()<int(header.size())?int(Qt::AlignCenter | Qt::AlignVCenter):int(Qt::AlignRight | Qt::AlignVCenter);
+        if(role==Qt::DisplayRole) return readCell(index.row(),index.column());
         return QVariant();
     }
 
@@ -258,9 +387,14 @@ public:
     bool setData(const QModelIndex &index, const QVariant &value, int role) override
     {
         if(index.isValid() && role==Qt::EditRole) {
-            std::vector<QString>&row=rawdata[index.row()];
-            QString &pos=row[index.column()];
-            pos=value.toString();
+            int r=index.row(), c=index.column(), H=int(header.size());
+            if(r<H) header[r][c]=value.toString();
+            else if(r>=H+numrows) footer[r-H-numrows][c]=value.toString();
+            else if(c>0&&c<=reported) {
+                r-=H;
+                size_t row=window>0?size_t((start+r)%window):size_t(r);
+                values[row*reported+c-1]=value.toFloat();
+            } else return false;
             emit dataChanged(index, index, {role});
             return true;
         }
@@ -276,15 +410,263 @@ public:
 
 
 private:
-    // Table values in a std vector of vectors of QStrings
-    std::vector<std::vector<QString>> rawdata;
-    // Rows and columns
-    int myrows, mycols;
+    // Header rows and rows after the iterations: text
+    std::vector<std::vector<QString>> header, footer;
+    // Iteration rows: results of the reported stages, one row after the other
+    std::vector<float> values;
+    // Columns, and reported stages per iteration
+    int mycols, reported;
+    // Iteration rows kept
+    int numrows;
+    // Position of the oldest iteration row kept in the ring buffer (window only)
+    int start;
+    // Maximum iteration rows (0: no limit)
+    int window;
+    // Iteration (0-based) of the oldest row kept
+    qint64 firstiter;
 
 };
 
 
 
+// Background model run on an immutable snapshot of the model (the compiled plan).
+// Results are handed over to the user interface in batches, announced by the
+// 'progress' signal at most FrameRate times per second.
+class RunThread : public QThread
+{
+    Q_OBJECT
+public:
+    static const int FrameRate=25;
+    // Maximum number of results waiting for the user interface, in blocks
+    static const int MaxPending=64;
+
+    // Optionally, the results are streamed to disk through 'w' as they are produced.
+    // In summary mode only the summary statistics and distributions of the reported stages are kept.
+    // With an active precision target the run stops as soon as it is reached, 'iters' being the maximum.
+    // In 'demographic' mode populations are whole individuals, which casters split at random.
+    RunThread(Plan &&p, float n, float eps, quint64 s, bool demographic, qint64 iters, ResultWriter *w, bool sum, const Precision &target, QObject *parent=nullptr):
+        QThread(parent), plan(std::move(p)), N(n), Eps(eps), seed(s), Demographic(demographic), Iters(iters), writer(w), summaryOnly(sum), precision(target) {
+        cancel=false;
+        writeError=false;
+        itersDone=0;
+        taken=0;
+        pendingRows=0;
+    }
+
+    // Whether streaming the results to disk failed
+    bool readWriteError() const {return writeError;}
+
+    // Iterations run, and the precision reached, once the run is over
+    qint64 readDone() const {return itersDone;}
+    const Precision &readPrecision() const {return precision;}
+    double readWorstRSE() const {return control?precision.readWorst(controlVariates):summaryOnly?precision.readWorst(summary):precision.readWorst();}
+
+    // Summary statistics, once the run is over (summary mode only)
+    bool readSummaryOnly() const {return summaryOnly;}
+    const Summary &readSummary() const {return summary;}
+
+    // Run every combination of the initial populations 'ns' and quasi-zero values 'eps' at once
+    // instead (summary mode only, without precision target)
+    void setSweep(const std::vector<float> &ns, const std::vector<float> &eps) {sweepN=ns; sweepEps=eps;}
+    bool readSweep() const {return !sweepN.empty();}
+    const std::vector<float> &readSweepN() const {return sweepN;}
+    const std::vector<float> &readSweepEps() const {return sweepEps;}
+    // Summary statistics of the combinations [eps x ns], once the run is over
+    const std::vector<Summary> &readSweepSummaries() const {return sweepSummaries;}
+
+    // Draw the casting rows from stratified sequences
+    void setSampling(Sampling s) {sampling=s;}
+    Sampling readSampling() const {return sampling;}
+
+    // Also estimate the means with control variates (summary mode only), which the precision target then uses
+    void setControl(bool c) {control=c;}
+    bool readControl() const {return control;}
+    const ControlVariates &readControlVariates() const {return controlVariates;}
+
+    // Compute the variance-based sensitivity indices of the castings instead (without precision target)
+    void setSobol(bool s) {sobol=s;}
+    bool readSobol() const {return sobol;}
+    // Indices, and the plan index of the casting of every group, once the run is over
+    const SobolIndices &readSobolIndices() const {return sobolIndices;}
+    const std::vector<int> &readSobolGroups() const {return sobolGroups;}
+
+    // Compare the model with the variants 'plans' with common random numbers instead, 'names'
+    // being those of the model and the variants (summary mode only, without precision target)
+    void setCompare(std::vector<Plan> &&plans, const std::vector<std::string> &names) {variants=std::move(plans); variantNames=names;}
+    bool readCompare() const {return !variants.empty();}
+    // Summaries of every variant and of their differences with the model, once the run is over
+    const std::vector<Summary> &readComparisonRuns() const {return comparisonRuns;}
+    const std::vector<Summary> &readComparisonDiffs() const {return comparisonDiffs;}
+    const std::vector<std::string> &readComparisonNames() const {return variantNames;}
+
+    // Run every scenario 'plans' of a grid instead, with their labels (summary mode only, without precision target)
+    void setScenarios(std::vector<Plan> &&plans, const std::vector<std::string> &labels) {scenarios=std::move(plans); scenarioLabels=labels;}
+    bool readScenarios() const {return !scenarios.empty();}
+    const std::vector<std::string> &readScenarioLabels() const {return scenarioLabels;}
+    // Summary statistics of every scenario, once the run is over
+    const std::vector<Summary> &readScenarioSummaries() const {return scenarioSummaries;}
+
+    // Stop the run as soon as possible
+    void Cancel() {
+        QMutexLocker lock(&mutex);
+        cancel=true;
+        drained.wakeAll();
+    }
+
+    // Number of reported stages per result row
+    int readReported() const {return plan.readReported();}
+
+    // Take the 'count' result rows produced since the last call: returns the iteration (0-based) of the first one
+    qint64 Take(std::vector<float> &rows, int &count) {
+        QMutexLocker lock(&mutex);
+        rows.swap(pending);
+        pending.clear();
+        count=int(pendingRows);
+        qint64 first=taken;
+        taken+=pendingRows;
+        pendingRows=0;
+        drained.wakeAll();
+        return first;
+    }
+
+signals:
+    // New results are available; 'done' iterations have been run so far
+    void progress(qint64 done);
+
+protected:
+    void run() override {
+        Engine engine(plan,N,Eps,seed,Demographic);
+        engine.setSampling(sampling,Iters);
+        int R=plan.readReported();
+        QElapsedTimer frame;
+        frame.start();
+        if(sobol) {
+            itersDone=Engine::Sobol(plan,N,Eps,seed,Demographic,Iters,0,sobolGroups,sobolIndices,[&](long done) {
+                if(frame.elapsed()>=1000/FrameRate) {
+                    frame.restart();
+                    emit progress(done);
+                }
+                QMutexLocker lock(&mutex);
+                return !cancel;
+            });
+            return;
+        }
+        if(readScenarios()) {
+            itersDone=Engine::Scenarios(scenarios,N,Eps,seed,Demographic,sampling,Iters,0,true,scenarioSummaries,[&](long done) {
+                if(frame.elapsed()>=1000/FrameRate) {
+                    frame.restart();
+                    emit progress(done);
+                }
+                QMutexLocker lock(&mutex);
+                return !cancel;
+            });
+            return;
+        }
+        if(readCompare()) {
+            std::vector<const Plan*> plans(1,&plan);
+            for(auto &&v: variants) plans.push_back(&v);
+            itersDone=Engine::Compare(plans,N,Eps,seed,Demographic,Iters,0,comparisonRuns,comparisonDiffs,[&](long done) {
+                if(frame.elapsed()>=1000/FrameRate) {
+                    frame.restart();
+                    emit progress(done);
+                }
+                QMutexLocker lock(&mutex);
+                return !cancel;
+            });
+            return;
+        }
+        if(readSweep()) {
+            itersDone=Engine::Sweep(plan,sweepN,sweepEps,seed,Iters,0,true,sweepSummaries,[&](long done) {
+                if(frame.elapsed()>=1000/FrameRate) {
+                    frame.restart();
+                    emit progress(done);
+                }
+                QMutexLocker lock(&mutex);
+                return !cancel;
+            });
+            return;
+        }
+        if(summaryOnly) {
+            itersDone=engine.Summarize(Iters,0,true,summary,[&](long done) {
+                if(frame.elapsed()>=1000/FrameRate) {
+                    frame.restart();
+                    emit progress(done);
+                }
+                if(precision.readActive()&&(control?precision.Reached(controlVariates):precision.Reached(summary))) return false;
+                QMutexLocker lock(&mutex);
+                return !cancel;
+            },control?&controlVariates:nullptr);
+            return;
+        }
+        itersDone=engine.Run(Iters,0,[&](long first, int count, const float *vals) {
+            if(writer&&!writer->Write(first,count,vals)) {
+                writeError=true;
+                return false;
+            }
+            {
+                QMutexLocker lock(&mutex);
+                // Wait for the user interface to catch up
+                while(!cancel&&pendingRows>=qint64(MaxPending)*Engine::BlockSize) {
+                    emit progress(first);
+                    drained.wait(&mutex);
+                }
+                if(cancel) return false;
+                pending.insert(pending.end(),vals,vals+size_t(count)*R);
+                pendingRows+=count;
+            }
+            if(precision.readActive()) {
+                precision.Add(count,vals);
+                if(precision.Reached()) {
+                    emit progress(first+count);
+                    return false;
+                }
+            }
+            if(frame.elapsed()>=1000/FrameRate||first+count>=Iters) {
+                frame.restart();
+                emit progress(first+count);
+            }
+            return true;
+        });
+        if(writer&&!writer->Close()) writeError=true;
+    }
+
+private:
+    const Plan plan;    // Snapshot of the model
+    float N;            // Initial population
+    float Eps;          // The quasi-zero value of the distribution tail
+    quint64 seed;       // Seed of the run
+    bool Demographic;   // Whole individuals split at random
+    qint64 Iters;       // Iterations to run
+    std::unique_ptr<ResultWriter> writer;   // Streaming of the results to disk, if any
+    bool writeError;
+    bool summaryOnly;   // Keep only the summary statistics
+    Summary summary;
+    Precision precision;    // Stop once the estimates are precise enough
+    std::vector<float> sweepN, sweepEps;    // Combinations of a sweep, if any
+    std::vector<Summary> sweepSummaries;
+    Sampling sampling=Sampling::Random; // How the casters draw their rows
+    bool control=false; // Means corrected with control variates
+    ControlVariates controlVariates;
+    bool sobol=false;   // Sensitivity indices instead of results
+    std::vector<Plan> variants; // Variants compared with the model, if any
+    std::vector<std::string> variantNames;
+    std::vector<Summary> comparisonRuns, comparisonDiffs;
+    std::vector<Plan> scenarios;    // Scenarios of a grid, if any
+    std::vector<std::string> scenarioLabels;
+    std::vector<Summary> scenarioSummaries;
+    std::vector<int> sobolGroups;
+    SobolIndices sobolIndices;
+    qint64 itersDone;   // Iterations run
+
+    QMutex mutex;
+    QWaitCondition drained;
+    bool cancel;
+    std::vector<float> pending; // Results not yet taken by the user interface
+    qint64 pendingRows;
+    qint64 taken;       // Rows already taken
+
+};
+
 // Tree node data for temporary storage during save & open operations
 class NodeData {
 public:
@@ -354,6 +736,12 @@ private slots:
 
     void on_actionRun_triggered();
 
+    void on_actionSensitivity_triggered();
+
+    void on_actionCompare_triggered();
+
+    void on_actionScenarios_triggered();
+
     void on_BCancel_clicked();
 
     void on_BCopyAll_clicked();
@@ -362,6 +750,10 @@ private slots:
 
     void on_BDupliTable_clicked();
 
+    void on_BCollapseTable_clicked();
+
+    void on_BPasteWeights_clicked();
+
     void on_BPasteTable_clicked();
 
     void on_BExpandTree_clicked();
@@ -380,13 +772,22 @@ private slots:
 
     void on_BShowSuccess_clicked();
 
+    // Show the results of the background run
+    void RunProgress(qint64 done);
+
+    void RunFinished();
+
 private:
     Ui::Stox *ui;
 
     QLabel *LSave;
     QLabel *LCheck;
 
-    std::list<TableModel*> Tables; // The list of castings
+    // Registry of castings: stages refer to a casting by its handle, the index in the
+    // registry, stored in column 1 of the stage (CastingRole). Deleted castings leave nullptr,
+    // so that handles stay stable.
+    static const int CastingRole=Qt::UserRole;
+    std::vector<TableModel*> Tables;
     int NumTables;
 
     OutTableModel *Output;
@@ -396,12 +797,15 @@ private:
     QString FileName;   // File name of saved model
     QString Path;       // Path to the folder where model has been last saved or opened
 
-    std::random_device  rand_dev;   // Random generator for bootstrapping
+    std::random_device  rand_dev;   // Random generator for the seeds of model runs
     std::mt19937 *generator;
 
     float Eps;      // The quasi-zero value of the distribution tail
 
-    bool GoOn;      // Flag to abort model run
+    RunThread *Runner;  // Model run in progress, if any
+    QString StreamName; // File the results of the last run were streamed to, if any
+    std::vector<StatRow> ExactStats;    // Exact moments of the current run, if asked for
+    std::vector<std::string> CastingNames;  // Names of the castings of the current run, by plan index
 
     int NodeType;   // Type of stage: Direct, Caster, Sink, or Success.
     QStringList TypeNames;
@@ -417,11 +821,41 @@ private:
     // Assigns a unique hyerachical ID to each stage in the model tree for identification
     void IDMarkTree();
     // Add a stage to the model tree
-    void AddTreeChild(QTreeWidgetItem *parent, QString name, QString cast, bool show);
+    void AddTreeChild(QTreeWidgetItem *parent, QString name, QString cast, bool show, int casting=-1);
+
+    // Register a casting, returns its handle
+    int AddTable(TableModel *table) {
+        Tables.push_back(table);
+        NumTables++;
+        return int(Tables.size())-1;
+    }
+    // Casting of a handle (nullptr if none)
+    TableModel *readTable(int handle) const {return handle>=0&&handle<int(Tables.size())?Tables[handle]:nullptr;}
+    // Handle of the casting selected in the list (-1 if none)
+    int SelectedCasting() const;
+    // Handle of the casting of a stage (-1 if none)
+    static int readCasting(const QTreeWidgetItem *stage) {
+        QVariant h=stage->data(1,CastingRole);
+        return h.isValid()?h.toInt():-1;
+    }
+    // Assign a casting to a stage (-1: none)
+    void setCasting(QTreeWidgetItem *stage, int handle);
+    // Set the handles of all stages from the names of their castings (models read from file)
+    void LinkCastings();
     // Expand the model tree
     void Xpand(QTreeWidgetItem &item);
-    // Apply bootstrapped transistion probabilities to stage node with a population n
-    void Cast(QTreeWidgetItem &node, float n);
+    // Compile the model tree into a flat execution plan for a model run
+    bool Compile(Plan &plan);
+    // Seed of a run from the user interface, or random if not given
+    bool ReadSeed(quint64 &seed);
+    // Set the output table for the rows of statistics of a run
+    void ShowHeader(const RunInfo &info);
+    // Start the background run set up in Runner, which keeps only statistics
+    void StartRun();
+    // Add the summary statistics of a run to the output table
+    void ShowSummary(const Summary &summary, Sampling sampling=Sampling::Random) {ShowStats(SummaryRows(summary,true,sampling));}
+    // Add rows of statistics to the output table
+    void ShowStats(const std::vector<StatRow> &stats);
     // Store stage node into serialized list
     void Dump(QTreeWidgetItem &node, int n);
     // Remove stage node
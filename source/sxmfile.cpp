@@ -0,0 +1,183 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+#include "sxmfile.h"
+
+#include <QFile>
+#include <QDataStream>
+#include <QVariant>
+#include <map>
+#include <algorithm>
+#include <numeric>
+
+// Data of a QTreeWidgetItem for a given role, as serialized by QTreeWidgetItem::write
+struct SxmItemData {
+    int role;
+    QVariant value;
+};
+
+QDataStream &operator>>(QDataStream &in, SxmItemData &data)
+{
+    in>>data.role>>data.value;
+    return in;
+}
+
+// Read the model in file 'filename'
+bool SxmFile::Load(const QString &filename)
+{
+    stages.clear();
+    castings.clear();
+
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly)) {
+        error="Could not open model "+filename;
+        return false;
+    }
+    QDataStream stream(&file);
+
+    // Read the serialized model tree: level and item for each stage, in preorder
+    int n;
+    stream>>n;
+    for(int i=0;i<n&&!stream.atEnd();++i) {
+        SxmStage stage;
+        stream>>stage.level;
+        // QTreeWidgetItem: the data for each column by role, then the displayed texts
+        QList<QList<SxmItemData>> values;
+        QList<QVariant> display;
+        stream>>values>>display;
+        stage.name=display.size()>0?display[0].toString():"";
+        stage.casting=display.size()>1?display[1].toString():"";
+        stage.report=false;
+        if(values.size()>2) for(auto &&d: values[2]) if(d.role==Qt::CheckStateRole) stage.report=d.value.toInt()==Qt::Checked;
+        stages.push_back(stage);
+    }
+
+    // Read the castings
+    stream>>n;
+    for(int i=0;i<n&&!stream.atEnd();++i) {
+        SxmCasting t;
+        stream>>t.name>>t.rows>>t.cols;
+        t.cells.resize(t.rows*t.cols);
+        for(auto &&f: t.cells) stream>>f;
+        castings.push_back(t);
+    }
+    // Read the row weights (none in models saved by earlier versions)
+    for(auto &&t: castings) {
+        if(stream.atEnd()) break;
+        stream>>n;
+        t.weights.resize(n);
+        for(auto &&w: t.weights) stream>>w;
+        if(n!=t.rows) t.weights.clear();
+    }
+    file.close();
+
+    if(stream.status()!=QDataStream::Ok||stages.empty()) {
+        error="Model "+filename+" is not a valid StoX model file";
+        return false;
+    }
+
+    // Assign hierarchical IDs, as Stox::IDMarkTree does
+    std::vector<int> counts(1,0);
+    std::vector<QString> ids;
+    for(auto &&s: stages) {
+        int l=s.level;
+        if(l==0) s.id="1";
+        else {
+            if(l>int(ids.size())) {
+                error="Model "+filename+" is not a valid StoX model file";
+                return false;
+            }
+            s.id=ids[l-1]+"."+QString::number(++counts[l-1]);
+        }
+        ids.resize(l+1);
+        ids[l]=s.id;
+        counts.resize(l+1);
+        counts[l]=0;
+    }
+
+    return true;
+}
+
+// Check the model for consistency and compile it into an execution plan
+bool SxmFile::Compile(Plan &plan)
+{
+    plan.Clear();
+
+    std::map<QString,int> index;
+    for(auto &&t: castings) {
+        const std::vector<float> &w=t.weights;
+        if(!w.empty()) {
+            if(std::any_of(w.begin(),w.end(),[](float x) {return !(x>=0.0f);})||std::accumulate(w.begin(),w.end(),0.0)<=0.0) {
+                error="Casting '"+t.name+"' has negative row weights or no positive one.";
+                return false;
+            }
+        }
+        index[t.name]=plan.AddCasting(t.rows,t.cols,t.cells.data(),t.weights.empty()?nullptr:t.weights.data());
+    }
+
+    // Stack of the stages leading to the current one
+    std::vector<int> path;
+    int S=int(stages.size());
+    for(int i=0;i<S;++i) {
+        const SxmStage &s=stages[i];
+        path.resize(s.level);
+        // Count following stages
+        int n=0;
+        for(int j=i+1;j<S&&stages[j].level>s.level;++j) if(stages[j].level==s.level+1) n++;
+
+        StageKind kind=StageKind::Caster;
+        int cast=-1;
+        QString where="Stage '"+s.name+"' ("+s.id+")";
+        if(n==0) {
+            if(s.casting=="Success") kind=StageKind::Success;
+            else if(s.casting=="Sink") kind=StageKind::Sink;
+            else {
+                error=where+" has no following stages, it should be type 'sink' or type 'success'.";
+                return false;
+            }
+        } else if(n==1) {
+            if(s.casting!="Direct") {
+                error=where+" has only one following stage, it should be type 'direct'.";
+                return false;
+            }
+            kind=StageKind::Direct;
+        } else {
+            auto t=index.find(s.casting);
+            if(t==index.end()) {
+                error=where+" has more than one following stage but no casting, it should have a casting set.";
+                return false;
+            }
+            if(castings[t->second].cols!=n) {
+                error=where+" has "+QString::number(n)+" following stages but its casting '"+s.casting+"' has "+QString::number(castings[t->second].cols)+" columns.";
+                return false;
+            }
+            cast=t->second;
+        }
+
+        path.push_back(plan.AddStage(path.empty()?-1:path.back(),kind,cast,s.report,s.name.toStdString(),s.id.toStdString()));
+    }
+    plan.Finish();
+
+    return true;
+}
@@ -0,0 +1,75 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+#ifndef SXMFILE_H
+#define SXMFILE_H
+
+#include <QString>
+#include <vector>
+
+#include "plan.h"
+
+// Stage read from a model file
+struct SxmStage {
+    int level;          // Depth in the model tree (0 for Start)
+    QString name;       // Stage name
+    QString casting;    // Stage type / associated casting table
+    QString id;         // Hierarchical ID, as assigned by Stox::IDMarkTree
+    bool report;        // Whether the stage is reported in the model output
+};
+
+// Casting table read from a model file
+struct SxmCasting {
+    QString name;
+    int rows, cols;
+    std::vector<float> cells;
+    std::vector<float> weights;     // Empty when rows are equally likely
+};
+
+// StoX model file (*.sxm) reader which only depends on Qt Core, so that models can be
+// run without any widget. It reads the layout written by Stox::on_actionSave_triggered.
+class SxmFile {
+public:
+    // Read the model in file 'filename'
+    bool Load(const QString &filename);
+
+    // Check the model for consistency and compile it into an execution plan
+    bool Compile(Plan &plan);
+
+    // Description of the last error
+    QString readError() const {return error;}
+
+    const std::vector<SxmStage> &readStages() const {return stages;}
+    const std::vector<SxmCasting> &readCastings() const {return castings;}
+
+private:
+    // Stages in preorder
+    std::vector<SxmStage> stages;
+    // Casting tables
+    std::vector<SxmCasting> castings;
+    QString error;
+
+};
+
+#endif // SXMFILE_H
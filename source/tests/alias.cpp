@@ -0,0 +1,63 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+// Weighted rows drawn through the alias table (Walker/Vose) in proportion to their weights
+
+#include "models.h"
+
+int main()
+{
+    // Skewed weights, a zero weight, and equal weights (no table)
+    std::vector<std::vector<float>> sets{{1,2,3,4,5,6,7},{100,1,1,0,0.5f,20},{0.001f,1000},{2,2,2}};
+    for(auto &&w: sets) {
+        int n=int(w.size());
+        Plan p;
+        std::vector<float> cells(n,1.0f);
+        const PlanCasting &t=p.readCasting(p.AddCasting(n,1,cells.data(),w.data()));
+        CHECK(t.alias.empty()==(n==3));
+
+        // Probability of every row in the table: kept in its own slot, or the alias of another
+        if(!t.alias.empty()) {
+            std::vector<double> q(n,0.0);
+            for(int r=0;r<n;++r) {
+                double keep=std::ldexp(double(t.prob[r]),-32);
+                q[r]+=keep/n;
+                q[t.alias[r]]+=(1.0-keep)/n;
+            }
+            for(int r=0;r<n;++r) CHECK_NEAR(q[r],t.readProbability(r),1e-6);
+        }
+
+        // Frequencies of the rows drawn over many iterations
+        const long Draws=1000000;
+        std::vector<long> counts(n,0);
+        for(long j=0;j<Draws;++j) counts[t.Row(21,j,4)]++;
+        for(int r=0;r<n;++r) {
+            double pr=t.readProbability(r);
+            CHECK_NEAR(counts[r],Draws*pr,5*std::sqrt(Draws*pr*(1-pr))+1);
+        }
+    }
+
+    return Report("alias");
+}
@@ -0,0 +1,128 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+// Demographic splits (Binomial): the sampler, individuals kept by full rows, and exact moments
+
+#include "models.h"
+#include "binomial.h"
+#include "engine.h"
+#include "analytic.h"
+
+int main()
+{
+    // Mean and variance of the draws, by inversion (small n p) and BTRS (large n p), for
+    // probabilities on both sides of 1/2 and populations up to a million
+    const double cases[][2]={{10,0.05},{200,0.02},{1000,0.003},{30,0.9},{100,0.3},{5000,0.5},{1e6,0.001},{1e6,0.37},{999983,0.9999}};
+    for(auto &&k: cases) {
+        double n=k[0], pr=k[1];
+        std::vector<double> x;
+        bool whole=true;
+        for(uint64_t iter=0;iter<20000;++iter) {
+            PhiloxStream stream(8,iter,5);
+            double y=Binomial::Draw(n,pr,stream);
+            if(y<0.0||y>n||y!=std::floor(y)) whole=false;
+            x.push_back(y);
+        }
+        CHECK(whole);
+        double mean, sd, var=n*pr*(1-pr);
+        MeanSD(x,mean,sd);
+        CHECK_NEAR(mean,n*pr,5*std::sqrt(var/x.size()));
+        // The variance of a sample variance is about (m4-var^2)/count, m4 the fourth central moment
+        double m4=var*(1.0+3.0*(n-2.0)*pr*(1-pr));
+        CHECK_NEAR(sd*sd,var,5*std::sqrt((m4-var*var)/x.size()));
+    }
+
+    // Multinomial splits never give out more individuals than there are
+    std::mt19937 g(12);
+    bool within=true;
+    for(uint64_t iter=0;iter<5000;++iter) {
+        float row[4];
+        std::uniform_real_distribution<float> u(0,1);
+        double s=0.0;
+        for(int c=0;c<4;++c) s+=row[c]=c&&u(g)<0.3f?0.0f:u(g)+0.01f;
+        for(auto &&f: row) f=float(f/s*(iter%2?1.0:0.9));
+        double n=std::floor(std::ldexp(u(g),1+int(iter%20))), total=0.0;
+        PhiloxStream stream(9,iter,2);
+        Binomial::Split(n,row,1,4,0.001f,stream,[&](int, float y) {total+=y;});
+        if(total>n||(iter%2&&total!=n)) within=false;
+    }
+    CHECK(within);
+
+    // Full rows with zeros share their individuals: none is made up by the quasi-zeros
+    const float rows[][3]={{0.7f,0.3f,0.0f},{1.0f,0.0f,0.0f},{0.5f,0.5f,0.0f},{0.0f,0.0f,1.0f}};
+    for(auto &&row: rows) {
+        bool kept=true;
+        for(uint64_t iter=0;iter<2000;++iter) {
+            PhiloxStream stream(3,iter,1);
+            double total=0.0;
+            Binomial::Split(1000,row,1,3,0.001f,stream,[&](int, float y) {total+=y;});
+            if(total!=1000) kept=false;
+        }
+        CHECK(kept);
+    }
+    // Rows adding up to more than 1 are offspring, drawn independently
+    const float offspring[]={1.5f,0.8f};
+    double mean0=0.0, mean1=0.0;
+    for(uint64_t iter=0;iter<2000;++iter) {
+        PhiloxStream stream(3,iter,2);
+        Binomial::Split(1000,offspring,1,2,0.001f,stream,[&](int c, float y) {(c?mean1:mean0)+=y/2000;});
+    }
+    CHECK_NEAR(mean0,1500,4*std::sqrt(1000*0.25/2000));
+    CHECK_NEAR(mean1,800,4*std::sqrt(1000*0.16/2000));
+
+    // A caster of full rows with zeros, one of them single: Plan::Run keeps every individual,
+    // and the moments of the engine are the exact ones
+    Plan p;
+    float cells[]={0.7f,0.3f,0.0f, 1.0f,0.0f,0.0f, 0.2f,0.5f,0.3f};
+    int t=p.AddCasting(3,3,cells);
+    int c=p.AddStage(-1,StageKind::Caster,t,false,"c","1");
+    for(int k=0;k<3;++k) p.AddStage(c,StageKind::Sink,-1,true,"s"+std::to_string(k),"1."+std::to_string(k+1));
+    p.Finish();
+    std::vector<float> pop(p.readStages()), out(3);
+    bool kept=true;
+    for(uint64_t iter=0;iter<1000;++iter) {
+        p.Run(500,0.001f,4,iter,pop.data(),out.data(),true);
+        if(out[0]+out[1]+out[2]!=500) kept=false;
+    }
+    CHECK(kept);
+    Analytic exact;
+    exact.Compute(p,500,0.001f,true);
+    Engine e(p,500,0.001f,4,true);
+    Summary sum;
+    const long Iters=400000;
+    e.Summarize(Iters,0,false,sum,[](long) {return true;});
+    double total=0.0;
+    for(int k=0;k<3;++k) {
+        const Moments &m=sum.readStage(k);
+        CHECK_NEAR(m.readMean(),exact.readMean(k),5*m.readSE());
+        CHECK_NEAR(m.readSD(),exact.readSD(k),0.02*exact.readSD(k));
+        total+=exact.readMean(k);
+    }
+    CHECK_NEAR(total,500,1e-4);
+    // Kids of the same individuals vary together less than on their own
+    CHECK(exact.readCovariance(0,1)<0.0);
+
+    return Report("binomial");
+}
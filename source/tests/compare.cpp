@@ -0,0 +1,87 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+// Paired comparison of model variants with common random numbers
+
+#include "models.h"
+#include "engine.h"
+#include "analytic.h"
+
+#include <set>
+
+int main()
+{
+    // The model, one of its castings edited, and a subtree removed
+    Plan base=RandomTree(3), edited=RandomTree(3,3,"",0.8f), removed=RandomTree(3,3,"2");
+    std::vector<const Plan*> plans{&base,&edited,&removed};
+    int R=base.readReported();
+    Analytic a, b;
+    a.Compute(base,1000,0.001f);
+    b.Compute(edited,1000,0.001f);
+
+    std::vector<std::vector<Summary>> runs(2), diffs(2);
+    for(int t=0;t<2;++t) CHECK(Engine::Compare(plans,1000,0.001f,5,false,100000,t?3:1,runs[t],diffs[t],[](long) {return true;})==100000);
+    CHECK(runs[0].size()==3&&diffs[0].size()==2);
+    int shrunk=0, random=0;
+    for(int c=0;c<R;++c) {
+        const Moments &d=diffs[0][0].readStage(c);
+        double unpaired=std::hypot(runs[0][0].readStage(c).readSE(),runs[0][1].readStage(c).readSE());
+        CHECK_NEAR(d.readMean(),b.readMean(c)-a.readMean(c),5*d.readSE()+1e-4*a.readMean(c));
+        if(unpaired>0.0) {
+            random++;
+            if(d.readSE()<unpaired/3) shrunk++;
+        }
+        // Stages of the removed subtree are zero, the others are found by path
+        const std::string &id=base.readID(base.readReportedStage(c));
+        if(id.size()>=1&&id[0]=='2') CHECK(runs[0][2].readStage(c).readMax()==0.0);
+        else CHECK(runs[0][2].readStage(c).readMean()==runs[0][0].readStage(c).readMean());
+        // The same whatever the number of threads
+        CHECK(d.readMean()==diffs[1][0].readStage(c).readMean());
+    }
+    // Most stages, those that do not follow the edited casting, do not change at all
+    CHECK(random>0&&shrunk>0);
+    CHECK(diffs[0][0].readStage(0).readSE()==0.0);
+
+    // Keys follow the path of a stage and are distinct within a plan
+    std::vector<uint32_t> keys=base.Keys(), kept=removed.Keys();
+    CHECK(std::set<uint32_t>(keys.begin(),keys.end()).size()==keys.size());
+    for(int i=0;i<removed.readStages();++i) for(int j=0;j<base.readStages();++j)
+        if(base.readPath(j)==removed.readPath(i)) CHECK(keys[j]==kept[i]);
+
+    // Ordinary runs keep drawing by position, as Plan::Run
+    Engine e(base,1000,0.001f,9);
+    std::vector<float> pop(base.readStages()), out(R);
+    bool same=true;
+    e.Run(3000,2,[&](long first, int count, const float *vals) {
+        for(int j=0;j<count;++j) {
+            base.Run(1000,0.001f,9,first+j,pop.data(),out.data());
+            for(int c=0;c<R;++c) if(std::fabs(out[c]-vals[j*R+c])>1e-5f*std::fabs(out[c])) same=false;
+        }
+        return true;
+    });
+    CHECK(same);
+
+    return Report("compare");
+}
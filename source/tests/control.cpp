@@ -0,0 +1,78 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+// Control-variate estimates of the stage means: precision, coverage and invariance
+
+#include "models.h"
+#include "engine.h"
+#include "analytic.h"
+
+int main()
+{
+    Plan tree=RandomTree(3);
+    int R=tree.readReported();
+    for(bool demographic: {false,true}) {
+        Analytic exact;
+        exact.Compute(tree,1000,0.001f,demographic);
+        std::vector<double> means;
+        for(int threads: {1,4}) {
+            Engine e(tree,1000,0.001f,7,demographic);
+            Summary sum;
+            ControlVariates cv;
+            e.Summarize(100000,threads,false,sum,[](long) {return true;},&cv);
+            CHECK(cv.readCount()==100000);
+            for(int c=0;c<R;++c) {
+                const Moments &m=sum.readStage(c);
+                // Deterministic stages stay exact, random ones get more precise (up to float
+                // rounding where the controls explain all the variance)
+                if(m.readSE()==0.0) CHECK(cv.readSE(c)==0.0);
+                else {
+                    CHECK(cv.readSE(c)<m.readSE());
+                    CHECK_NEAR(cv.readMean(c),exact.readMean(c),5*cv.readSE(c)+1e-6*exact.readMean(c));
+                }
+            }
+            CHECK(cv.readSE(R-1)<0.6*sum.readStage(R-1).readSE());
+            means.push_back(cv.readMean(R-1));
+        }
+        // The same whatever the number of threads
+        CHECK(means[0]==means[1]);
+    }
+
+    // The corrected SE covers the exact mean as often as it should
+    Analytic exact;
+    exact.Compute(tree,1000,0.001f);
+    const int Runs=200;
+    int covered=0;
+    for(int k=0;k<Runs;++k) {
+        Engine e(tree,1000,0.001f,100+k);
+        Summary sum;
+        ControlVariates cv;
+        e.Summarize(5000,2,false,sum,[](long) {return true;},&cv);
+        if(std::fabs(cv.readMean(R-1)-exact.readMean(R-1))<1.96*cv.readSE(R-1)) covered++;
+    }
+    CHECK(covered>=0.89*Runs&&covered<=0.99*Runs);
+
+    return Report("control");
+}
@@ -0,0 +1,80 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+// Block engine (Engine::Run, Summarize): the iterations of Plan::Run, whatever the threads
+
+#include "models.h"
+#include "engine.h"
+
+int main()
+{
+    Plan p=RandomTree(4);
+    int R=p.readReported();
+    const long Iters=5000;     // Not a whole number of blocks
+    for(bool demographic: {false,true}) {
+        // Blocks in order, every iteration as Plan::Run gives it alone
+        std::vector<std::vector<float>> runs;
+        for(int threads: {1,2,4,0}) {
+            Engine e(p,1000,0.001f,11,demographic);
+            std::vector<float> vals;
+            long next=0;
+            long done=e.Run(Iters,threads,[&](long first, int count, const float *v) {
+                CHECK(first==next&&count>0&&count<=Engine::BlockSize);
+                next=first+count;
+                vals.insert(vals.end(),v,v+size_t(count)*R);
+                return true;
+            });
+            CHECK(done==Iters&&next==Iters);
+            runs.push_back(vals);
+        }
+        for(size_t k=1;k<runs.size();++k) CHECK(runs[k]==runs[0]);
+        std::vector<float> pop(p.readStages()), out(R);
+        int differ=0;
+        for(long j=0;j<Iters;++j) {
+            p.Run(1000,0.001f,11,j,pop.data(),out.data(),demographic);
+            // Folded subtrees may differ in the last bit
+            for(int c=0;c<R;++c) if(std::fabs(out[c]-runs[0][j*R+c])>1e-5f*std::fabs(out[c])) differ++;
+        }
+        CHECK(differ==0);
+
+        // Summaries merged in block order do not depend on the threads either
+        std::vector<Summary> sums(2);
+        for(int t=0;t<2;++t) {
+            Engine e(p,1000,0.001f,11,demographic);
+            CHECK(e.Summarize(Iters,t?3:1,true,sums[t],[](long) {return true;})==Iters);
+        }
+        for(int c=0;c<R;++c) {
+            CHECK(sums[0].readStage(c).readMean()==sums[1].readStage(c).readMean());
+            CHECK(sums[0].readStage(c).readSD()==sums[1].readStage(c).readSD());
+        }
+
+        // A run stops at the end of the block whose sink says so
+        Engine e(p,1000,0.001f,11,demographic);
+        long done=e.Run(Iters,3,[&](long first, int count, const float *) {return first+count<2*Engine::BlockSize;});
+        CHECK(done==2*Engine::BlockSize);
+    }
+
+    return Report("engine");
+}
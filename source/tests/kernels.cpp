@@ -0,0 +1,69 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+// Kernels of the block engine against the scalar formulas, for the set picked by STOX_KERNELS
+
+#include <cstdlib>
+#include <cstring>
+
+#include "models.h"
+#include "kernels.h"
+
+int main()
+{
+    const Kernels &k=Kernels::Best();
+    const char *ask=std::getenv("STOX_KERNELS");
+    if(ask&&std::strcmp(ask,k.name)) std::printf("kernels: %s not available, testing %s\n",ask,k.name);
+
+    std::mt19937 g(5);
+    Plan p;
+    int plain=RandomCasting(p,g,7), weighted=RandomCasting(p,g,11,true);
+    std::uniform_real_distribution<float> u(0,1000);
+    const int Size=1000;
+    std::vector<float> pop(Size), col(11), kid(Size);
+    for(auto &&x: pop) x=u(g);
+    for(auto &&x: col) x=u(g)/1000;
+    std::vector<int> rows(Size);
+
+    // Every length and alignment, to go through the vector loops and the tails
+    for(int count: {1,3,7,8,15,16,17,31,33,100,Size-5})
+        for(int offset: {0,1,5}) {
+            if(offset+count>Size) continue;
+            for(int t: {plain,weighted}) {
+                const PlanCasting &c=p.readCasting(t);
+                bool alias=!c.alias.empty();
+                CHECK(alias==(t==weighted));
+                uint64_t first=0xFFFFFFF0ULL+offset;   // Iterations across 2^32
+                k.Rows(77,first,9,c.rows,alias?c.prob.data():nullptr,alias?c.alias.data():nullptr,rows.data()+offset,count);
+                for(int j=0;j<count;++j) CHECK(rows[offset+j]==c.Row(77,first+j,9));
+            }
+            k.Scale(pop.data()+offset,0.37f,kid.data()+offset,count);
+            for(int j=0;j<count;++j) CHECK(kid[offset+j]==pop[offset+j]*0.37f);
+            k.Gather(pop.data()+offset,col.data(),rows.data()+offset,kid.data()+offset,count);
+            for(int j=0;j<count;++j) CHECK(kid[offset+j]==pop[offset+j]*col[rows[offset+j]]);
+        }
+
+    return Report("kernels");
+}
@@ -0,0 +1,114 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+// Shared helpers of the tests of the engine: small models and checks
+
+#ifndef TESTS_MODELS_H
+#define TESTS_MODELS_H
+
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "plan.h"
+
+// Failed checks so far
+inline int failures=0;
+
+// Check a condition, reporting it if it fails
+#define CHECK(cond) do { if(!(cond)) { std::printf("%s:%d: check failed: %s\n",__FILE__,__LINE__,#cond); failures++; } } while(0)
+
+// Check that a is within tol of b
+#define CHECK_NEAR(a,b,tol) do { double a_=(a), b_=(b); if(!(std::fabs(a_-b_)<=(tol))) { \
+    std::printf("%s:%d: check failed: %s=%g, %s=%g (tolerance %g)\n",__FILE__,__LINE__,#a,a_,#b,b_,double(tol)); failures++; } } while(0)
+
+// Result of a test program
+inline int Report(const char *name)
+{
+    if(failures) std::printf("%s: %d checks failed\n",name,failures);
+    else std::printf("%s: passed\n",name);
+    return failures?1:0;
+}
+
+// Random casting of 'rows' rows of three columns, every row adding up to 1 (some cells zero),
+// with random row weights if 'weighted', and then the first column times 'scale'
+inline int RandomCasting(Plan &p, std::mt19937 &g, int rows, bool weighted=false, float scale=1.0f)
+{
+    std::uniform_real_distribution<float> u(0,1);
+    std::vector<float> c(rows*3), w(rows);
+    for(auto &&x: c) x=u(g)<0.2f?0.0f:u(g);
+    for(int r=0;r<rows;++r) {
+        float s=c[r*3]+c[r*3+1]+c[r*3+2];
+        if(s>0) for(int k=0;k<3;++k) c[r*3+k]/=s;
+        c[r*3]*=scale;
+    }
+    for(auto &&x: w) x=1.0f+u(g);
+    return p.AddCasting(rows,3,c.data(),weighted?w.data():nullptr);
+}
+
+// Tree of 'depth' levels of a Direct stage and a caster of three following stages, every stage
+// named by its path, over four random castings (the first of a single row, the last weighted).
+// The stage named 'skip' by its path (e.g. "12") is replaced by a sink of another name,
+// so its subtree is gone while the casting columns of the others keep their positions.
+// The first column of the third casting is times 'scale'.
+inline Plan RandomTree(int depth, unsigned seed=3, const std::string &skip="", float scale=1.0f)
+{
+    Plan p;
+    std::mt19937 g(seed);
+    std::vector<int> tabs;
+    for(int t=0;t<4;++t) tabs.push_back(RandomCasting(p,g,t==0?1:5+t,t==3,t==2?scale:1.0f));
+    std::function<void(int,int,std::string)> add=[&](int parent, int level, std::string name) {
+        if(level==0) {
+            p.AddStage(parent,StageKind::Sink,-1,true,"s"+name,name);
+            return;
+        }
+        int d=p.AddStage(parent,StageKind::Direct,-1,level%2,"d"+name,name);
+        int c=p.AddStage(d,StageKind::Caster,tabs[level%4],true,"c"+name,name);
+        for(int k=0;k<3;++k) {
+            std::string kid=name+char('1'+k);
+            if(kid==skip) p.AddStage(c,StageKind::Sink,-1,true,"r"+kid,"r"+kid);
+            else add(c,level-1,kid);
+        }
+    };
+    add(-1,depth,"");
+    p.Finish();
+    return p;
+}
+
+// Sample mean and SD of some values
+inline void MeanSD(const std::vector<double> &x, double &mean, double &sd)
+{
+    mean=0.0;
+    for(double v: x) mean+=v;
+    mean/=x.size();
+    double m2=0.0;
+    for(double v: x) m2+=(v-mean)*(v-mean);
+    sd=std::sqrt(m2/(x.size()-1));
+}
+
+#endif // TESTS_MODELS_H
@@ -0,0 +1,80 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+// Philox4x32-10 against its known-answer vectors, and the keying of the draws of a run
+
+#include "models.h"
+#include "philox.h"
+
+// Counter (c0,c1,c2,c3), key (k0,k1) and output of Philox4x32-10 (Random123 kat_vectors)
+struct KnownAnswer {
+    uint32_t ctr[4], key[2], out[4];
+};
+
+int main()
+{
+    const KnownAnswer kat[]={
+        {{0x00000000,0x00000000,0x00000000,0x00000000},{0x00000000,0x00000000},{0x6627e8d5,0xe169c58d,0xbc57ac4c,0x9b00dbd8}},
+        {{0xffffffff,0xffffffff,0xffffffff,0xffffffff},{0xffffffff,0xffffffff},{0x408f276d,0x41c83b0e,0xa20bc7c6,0x6d5451fd}},
+        {{0x243f6a88,0x85a308d3,0x13198a2e,0x03707344},{0xa4093822,0x299f31d0},{0xd16cfe09,0x94fdcceb,0x5001e420,0x24126ea1}},
+    };
+    for(auto &&k: kat) {
+        uint32_t out[4];
+        Philox::Draw(k.key[0]|uint64_t(k.key[1])<<32,k.ctr[0],k.ctr[1],k.ctr[2],k.ctr[3],out);
+        for(int w=0;w<4;++w) CHECK(out[w]==k.out[w]);
+    }
+
+    // Draws are counted by (iteration, stage, draw) under the seed: 64-bit iterations and
+    // seeds are used whole, and the row draw (draw 0) is never reused by a stream
+    const uint64_t seed=0x0123456789abcdefULL, iter=0x100000002ULL;
+    uint32_t out[4];
+    Philox::Draw(seed,uint32_t(iter),uint32_t(iter>>32),7,0,out);
+    CHECK(Philox::Word(seed,iter,7)==out[0]);
+    CHECK(Philox::Word(seed,iter,7)!=Philox::Word(seed,uint32_t(iter),7));
+    CHECK(Philox::Word(seed,iter,7)!=Philox::Word(seed^(uint64_t(1)<<40),iter,7));
+    CHECK(Philox::Word(seed,iter,7)!=Philox::Word(seed,iter,8));
+    PhiloxStream stream(seed,iter,7);
+    for(uint32_t draw=1;draw<=3;++draw) {
+        Philox::Draw(seed,uint32_t(iter),uint32_t(iter>>32),7,draw,out);
+        for(int w=0;w<4;++w) CHECK(stream.Next()==out[w]);
+    }
+
+    // Uniforms in range, and rows evenly spread
+    std::vector<int> counts(6,0);
+    for(uint64_t j=0;j<600000;++j) {
+        uint32_t w=Philox::Word(seed,j,3);
+        float u=Philox::Unit(w);
+        CHECK(u>=0.0f&&u<1.0f);
+        counts[Philox::Below(w,6)]++;
+    }
+    for(int c: counts) CHECK_NEAR(c,100000,4*std::sqrt(100000*5.0/6));
+    PhiloxStream s(seed,0,0);
+    for(int j=0;j<1000;++j) {
+        double u=s.Uniform();
+        CHECK(u>0.0&&u<1.0);
+    }
+
+    return Report("philox");
+}
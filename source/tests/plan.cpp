@@ -0,0 +1,108 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+// Compiled plan (Plan::Run) against the recursive walk of the model tree it replaced
+
+#include "models.h"
+
+// Stage of a model tree as the user interface holds it
+struct TreeStage {
+    StageKind kind;
+    int casting;
+    bool report;
+    std::vector<TreeStage> kids;
+};
+
+// Random tree below a stage of 'level' levels, over castings of three columns
+static void Grow(TreeStage &s, int level, std::mt19937 &g, int castings)
+{
+    std::uniform_int_distribution<int> kind(0,5), table(0,castings-1);
+    for(auto &&k: s.kids) {
+        int x=level?kind(g):5;
+        k.kind=x<2?StageKind::Direct:x<4?StageKind::Caster:x==4?StageKind::Success:StageKind::Sink;
+        k.casting=k.kind==StageKind::Caster?table(g):-1;
+        k.report=g()%3!=0;
+        if(k.kind==StageKind::Direct) k.kids.resize(1);
+        if(k.kind==StageKind::Caster) k.kids.resize(3);
+        Grow(k,level-1,g,castings);
+    }
+}
+
+// Add the stages in preorder, as read from the tree widget
+static void Compile(const TreeStage &s, int parent, Plan &p)
+{
+    int i=p.AddStage(parent,s.kind,s.casting,s.report,"s"+std::to_string(p.readStages()),"");
+    for(auto &&k: s.kids) Compile(k,i,p);
+}
+
+// The former recursive cast: every stage takes its population and casts it on at once,
+// drawing its row when it is visited
+static void Cast(const TreeStage &s, float n, const Plan &p, float eps, uint64_t seed, uint64_t iter,
+                 int &visit, std::vector<float> &out)
+{
+    int stage=visit++;
+    if(s.report) out.push_back(n);
+    if(s.kind==StageKind::Direct) Cast(s.kids[0],n,p,eps,seed,iter,visit,out);
+    if(s.kind!=StageKind::Caster) return;
+    const PlanCasting &t=p.readCasting(s.casting);
+    int r=t.Row(seed,iter,uint32_t(stage));
+    for(size_t c=0;c<s.kids.size();++c) {
+        float f=t.cells[r*t.cols+c];
+        Cast(s.kids[c],n*(f>0.0?f:eps),p,eps,seed,iter,visit,out);
+    }
+}
+
+int main()
+{
+    for(unsigned seed=1;seed<=20;++seed) {
+        std::mt19937 g(seed);
+        Plan p;
+        for(int t=0;t<3;++t) RandomCasting(p,g,1+3*t,t==2);
+        TreeStage root{StageKind::Caster,int(g()%3),true,std::vector<TreeStage>(3)};
+        Grow(root,5,g,3);
+        Compile(root,-1,p);
+        p.Finish();
+
+        // The same populations, drawn by the same stages in the same order
+        std::vector<float> pop(p.readStages()), out(p.readReported());
+        for(uint64_t iter=0;iter<200;++iter) {
+            p.Run(1000,0.001f,seed,iter,pop.data(),out.data());
+            std::vector<float> cast;
+            int visit=0;
+            Cast(root,1000,p,0.001f,seed,iter,visit,cast);
+            CHECK(visit==p.readStages());
+            CHECK(cast==out);
+        }
+
+        // Every stage follows the one feeding it, its subtree right after it
+        for(int i=0;i<p.readStages();++i) {
+            const PlanNode &nd=p.readNode(i);
+            CHECK(nd.parent<i&&nd.end>i&&nd.end<=p.readStages());
+            for(int c=0;c<nd.count;++c) CHECK(p.readNode(p.readKid(nd.first+c)).parent==i);
+        }
+    }
+
+    return Report("plan");
+}
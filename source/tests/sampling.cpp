@@ -0,0 +1,114 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+// Stratified row sampling (Latin hypercube, scrambled Sobol): balance, variance and invariance
+
+#include "models.h"
+#include "engine.h"
+#include "analytic.h"
+
+// Times every row of the first caster of 'p' is drawn in the first 'count' iterations
+static std::vector<int> Counts(const Plan &p, Sampling s, long total, int count)
+{
+    Engine e(p,1000,0.001f,5);
+    e.setSampling(s,total);
+    std::vector<int> log(size_t(p.readStages())*Engine::BlockSize);
+    e.DrawRows(0,count,log.data());
+    std::vector<int> counts(p.readCasting(0).rows,0);
+    for(int j=0;j<count;++j) counts[log[j]]++;
+    return counts;
+}
+
+// A caster of 'rows' rows of two columns, and its two sinks
+static Plan OneCaster(int rows)
+{
+    Plan p;
+    float c[]={0.1f,0.9f, 0.3f,0.7f, 0.5f,0.5f, 0.7f,0.3f, 0.9f,0.1f};
+    p.AddCasting(rows,2,c);
+    int s0=p.AddStage(-1,StageKind::Caster,0,true,"a","1");
+    p.AddStage(s0,StageKind::Sink,-1,true,"b","1.1");
+    p.AddStage(s0,StageKind::Sink,-1,true,"c","1.2");
+    p.Finish();
+    return p;
+}
+
+int main()
+{
+    // Every power of two of Sobol points, and the whole hypercube, split the rows evenly
+    CHECK(Counts(OneCaster(4),Sampling::Sobol,0,1024)==std::vector<int>(4,256));
+    CHECK(Counts(OneCaster(5),Sampling::LatinHypercube,1000,1000)==std::vector<int>(5,200));
+
+    // Past the Sobol dimensions every stratum of the run is drawn once, unlike a copy of one
+    const uint64_t Total=1000;
+    for(int dim: {Sequence::SobolDims,Sequence::SobolDims+1}) {
+        std::vector<int> strata(Total,0);
+        bool copy=true;
+        for(uint64_t i=0;i<Total;++i) {
+            uint32_t x=Sequence::Sobol(7,i,Total,dim);
+            strata[size_t((uint64_t(x)*Total)>>32)]++;
+            copy=copy&&x==Sequence::Sobol(7,i,Total,0);
+        }
+        CHECK(strata==std::vector<int>(Total,1));
+        CHECK(!copy);
+    }
+
+    // The mean of a deep stage over independent seeds: unbiased, and less spread than at random
+    Plan tree=RandomTree(3);
+    int R=tree.readReported(), stage=R-1;
+    Analytic exact;
+    exact.Compute(tree,1000,0.001f);
+    const int Seeds=40, Iters=2048;
+    std::vector<double> sd(3);
+    for(int s=0;s<3;++s) {
+        std::vector<double> means;
+        for(int k=0;k<Seeds;++k) {
+            Engine e(tree,1000,0.001f,100+k);
+            e.setSampling(Sampling(s),Iters);
+            Summary sum;
+            e.Summarize(Iters,2,false,sum,[](long) {return true;});
+            means.push_back(sum.readStage(stage).readMean());
+        }
+        double mean;
+        MeanSD(means,mean,sd[s]);
+        CHECK_NEAR(mean,exact.readMean(stage),4*sd[s]/std::sqrt(double(Seeds)));
+    }
+    CHECK(sd[int(Sampling::LatinHypercube)]<sd[int(Sampling::Random)]);
+    CHECK(sd[int(Sampling::Sobol)]<sd[int(Sampling::Random)]);
+
+    // The same whatever the number of threads
+    for(Sampling s: {Sampling::LatinHypercube,Sampling::Sobol}) {
+        std::vector<double> means;
+        for(int threads: {1,3}) {
+            Engine e(tree,1000,0.001f,9);
+            e.setSampling(s,5000);
+            Summary sum;
+            e.Summarize(5000,threads,false,sum,[](long) {return true;});
+            means.push_back(sum.readStage(stage).readMean());
+        }
+        CHECK(means[0]==means[1]);
+    }
+
+    return Report("sampling");
+}
@@ -0,0 +1,89 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+// Scenario grids: parsing, rejected grids, and runs matching those of each scenario alone
+
+#include "models.h"
+#include "engine.h"
+#include "scenarios.h"
+
+int main()
+{
+    Plan base=RandomTree(3);
+    std::vector<std::string> names{"t0","t1","t2","t3"};
+
+    // A column scaled down in three steps, times the weighted casting or an unweighted copy
+    ScenarioGrid grid;
+    CHECK(grid.Parse("# scaling and replacement\nscale t2 * 1 0.5 1 3\nreplace t3 t3 t1\n",base,names));
+    CHECK(grid.readScenarios()==6);
+    std::vector<Plan> plans;
+    std::vector<std::string> labels;
+    for(long s=0;s<grid.readScenarios();++s) {
+        std::string label;
+        plans.push_back(grid.Build(base,s,label));
+        labels.push_back(label);
+    }
+    CHECK(plans[5].readCasting(3).rows==plans[5].readCasting(1).rows);
+    CHECK(labels[0]!=labels[1]&&labels[1]!=labels[2]);
+
+    // Every scenario as if run alone, whatever the number of threads, also for whole individuals
+    for(bool demographic: {false,true}) {
+        std::vector<std::vector<Summary>> runs(2);
+        for(int t=0;t<2;++t)
+            CHECK(Engine::Scenarios(plans,1000,0.001f,5,demographic,Sampling::Random,5000,t?3:1,false,runs[t],[](long) {return true;})==5000);
+        for(size_t k=0;k<plans.size();++k) {
+            Engine e(plans[k],1000,0.001f,5,demographic);
+            Summary alone;
+            e.Summarize(5000,2,false,alone,[](long) {return true;});
+            for(int c=0;c<base.readReported();++c) {
+                CHECK(runs[0][k].readStage(c).readMean()==alone.readStage(c).readMean());
+                CHECK(runs[1][k].readStage(c).readMean()==alone.readStage(c).readMean());
+            }
+        }
+    }
+
+    // Rejected grids, leaving no scenarios
+    for(const char *text: {"scale t2 * * 0.5 1 1e12\n","scale t2 * * 0.5 1 inf\n","scale t2 99 * 0.5 1 3\n",
+                           "replace t9 t1\n","scale t2 * 1 1 2 3\n",""}) {
+        ScenarioGrid bad;
+        CHECK(!bad.Parse(text,base,names));
+        CHECK(!bad.readError().empty());
+        CHECK(bad.readScenarios()==0);
+    }
+
+    // A full row keeps sharing its individuals when its zeros are scaled, not when its fractions are
+    Plan full;
+    float c[]={1.0f,0.0f, 0.5f,0.5f};
+    full.AddCasting(2,2,c);
+    int s0=full.AddStage(-1,StageKind::Caster,0,true,"a","1");
+    full.AddStage(s0,StageKind::Sink,-1,true,"b","1.1");
+    full.AddStage(s0,StageKind::Sink,-1,true,"c","1.2");
+    full.Finish();
+    ScenarioGrid zeros, fractions;
+    CHECK(zeros.Parse("scale c 1 2 1 3 3\n",full,{"c"}));
+    CHECK(!fractions.Parse("scale c 2 2 1 3 3\n",full,{"c"}));
+
+    return Report("scenarios");
+}
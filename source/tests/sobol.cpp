@@ -0,0 +1,68 @@
+/********************************************************************************************
+ *                                                                                          *
+ *  StoX                                                                                    *
+ *  ----                                                                                    *
+ *                                                                                          *
+ *  Copyright 2008-2024 J.Martín-Herrero (Universiy of Vigo, Spain).                        *
+ *                        julio@uvigo.es                                                    *
+ *                                                                                          *
+ *  This file is part of StoX.                                                              *
+ *                                                                                          *
+ *  StoX is free software: you can redistribute it and/or modify it under the terms of      *
+ *  the GNU General Public License as published by the Free Software Foundation, either     *
+ *  version 3 of the License, or any later version.                                         *
+ *                                                                                          *
+ *  StoX is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;       *
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR        *
+ *  PURPOSE. See the GNU General Public License for more details.                           *
+ *                                                                                          *
+ *  You should have received a copy of the GNU General Public License along with StoX.      *
+ *  If not, see <https://www.gnu.org/licenses/>.                                            *
+ *                                                                                          *
+ *                                                                                          *
+ ********************************************************************************************/
+
+
+// Sobol indices of the castings (Engine::Sobol) against their closed form
+
+#include "models.h"
+#include "engine.h"
+
+int main()
+{
+    // Start -> caster A -> caster B -> reported sink: the sink gets N*a*b
+    Plan p;
+    float a[]={0.2f,0.8f, 0.4f,0.6f, 0.6f,0.4f, 0.8f,0.2f};
+    float b[]={0.1f,0.9f, 0.5f,0.5f, 0.9f,0.1f};
+    int ta=p.AddCasting(4,2,a), tb=p.AddCasting(3,2,b);
+    int ca=p.AddStage(-1,StageKind::Caster,ta,false,"A","1");
+    int cb=p.AddStage(ca,StageKind::Caster,tb,false,"B","1.1");
+    p.AddStage(ca,StageKind::Sink,-1,false,"lost A","1.2");
+    p.AddStage(cb,StageKind::Sink,-1,true,"s","1.1.1");
+    p.AddStage(cb,StageKind::Sink,-1,false,"lost B","1.1.2");
+    p.Finish();
+
+    // Y=a*b of independent a, b: first-order V(E[Y|a])=V(a)E[b]^2, total E[V(Y|b)]=V(a)E[b^2]
+    double ea=0.5, ea2=(0.04+0.16+0.36+0.64)/4, eb=0.5, eb2=(0.01+0.25+0.81)/3;
+    double va=ea2-ea*ea, vb=eb2-eb*eb, v=ea2*eb2-ea*ea*eb*eb;
+
+    std::vector<SobolIndices> runs(2);
+    for(int t=0;t<2;++t) {
+        std::vector<int> groups;
+        long done=Engine::Sobol(p,1000,0.001f,17,false,200000,t?3:1,groups,runs[t],[](long) {return true;});
+        CHECK(done==200000);
+        CHECK(groups==std::vector<int>({ta,tb}));
+    }
+    const SobolIndices &s=runs[0];
+    CHECK_NEAR(s.readFirst(0,0),va*eb*eb/v,0.03);
+    CHECK_NEAR(s.readFirst(1,0),vb*ea*ea/v,0.03);
+    CHECK_NEAR(s.readTotal(0,0),va*eb2/v,0.03);
+    CHECK_NEAR(s.readTotal(1,0),vb*ea2/v,0.03);
+    CHECK_NEAR(s.readVariance(0),1e6*v,0.03*1e6*v);
+
+    // The same whatever the number of threads
+    CHECK(runs[0].readFirst(0,0)==runs[1].readFirst(0,0));
+    CHECK(runs[0].readTotal(1,0)==runs[1].readTotal(1,0));
+
+    return Report("sobol");
+}